@@ -1,4 +0,0 @@
-#!/bin/bash
-
-xset r rate 200
-~/.config/polybar/launch_polybar.sh &
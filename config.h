@@ -8,6 +8,7 @@
 // Moody Settings
 #define WM_NAME "moody" // Set wm name for neofetch to use
 #define MAX_WORKSPACES 9
+#define MAX_DISPLAYS 64 // Displays one moody can manage (moody -d ...)
 
 // Modifier keys
 #define MODIFIER Mod1Mask // Mod1Mask = alt, Mod4Mask = Super key(Windows key)
@@ -20,14 +21,47 @@
 #define DEFAULT_WINDOW_WIDTH 800
 #define DEFAULT_WINDOW_HEIGHT 800
 #define MAX_WINDOWS 500 // Set max windows per workspace
+#define MAX_PENDING_WINDOWS 64 // Created but not yet mapped windows to track
+#define WORKER_QUEUE_SIZE 256   // Windows waiting for background lookups
+#define EVENT_BATCH_SIZE 128    // Events read at once, input is handled first
+#define MAX_DOCKS 16            // Bars and panels
+#define CONFIGURE_RATE_LIMIT 30 // Configure requests per second per window
+                                // before moody treats it as a loop
+#define CLIENT_SAMPLE_INTERVAL 5000 // ms between reading every client's CPU
+                                    // and memory from /proc, 0 for never
+#define MAX_CLIENTS 128 // Clients whose activity is kept
 #define BORDER_WIDTH 4
 #define BORDER_COLOR "#ffffff"          // Set active border color to white
 #define INACTIVE_BORDER_COLOR "#333333" // Set inactive border color to grey
 
+// Spatial index
+// Windows are looked up by position (directional focus, the window under the
+// pointer, placing floating windows) through a grid of this many cells over
+// the screen
+#define INDEX_COLS 16
+#define INDEX_ROWS 16
+
+// Hiding workspaces
+// false = unmap windows of hidden workspaces (they repaint when shown again)
+// true = keep them mapped but move them offscreen, so switching back is just
+// a move. Nicer for browsers and GL apps, costs a bit of memory
+#define PARK_HIDDEN_WINDOWS false
+
+// Layouts
+#define LAYOUT_TILE 0    // Master and stack
+#define LAYOUT_MONOCLE 1 // Only the focused tile is shown, over the whole
+                         // work area, the others stay hidden
+#define DEFAULT_LAYOUT LAYOUT_TILE // What every workspace starts with
+
 // Gaps
 #define INNER_GAP 20 // Gap between windows
 #define OUTER_GAP 30 // Gap between windows and screen edge
 
+// Runtime config file, relative to $XDG_CONFIG_HOME (or ~/.config).
+// Anything set there overrides the defaults in this file and is reloaded
+// live whenever the file is saved.
+#define CONFIG_FILE "moody/moodyrc"
+
 // Keybindings
 
 // Dont care about this
@@ -42,6 +76,15 @@ typedef struct {
 #define KILL_KEY XK_q        // mod+q for killing the current window
 #define NEXT_WINDOW_KEY XK_k // mod+k to focus next window
 #define PREV_WINDOW_KEY XK_j // mod+j to focus previous window
+#define MRU_WINDOW_KEY XK_Tab // mod+tab to go back to the last focused window,
+                              // keep pressing to go further back
+#define MRU_CYCLE_TIMEOUT 1000 // ms between presses that continue a cycle
+#define MONOCLE_KEY XK_m // mod+m to switch the workspace between tiling and
+                         // monocle
+#define FOCUS_LEFT_KEY XK_Left // mod+arrows to focus the nearest window in
+#define FOCUS_RIGHT_KEY XK_Right // that direction
+#define FOCUS_UP_KEY XK_Up
+#define FOCUS_DOWN_KEY XK_Down
 
 static Keybinding keybindings[] = {
     {XK_Return, MODIFIER, "xterm", -1}, // mod+return to open xterm (terminal)
@@ -95,4 +138,69 @@ static Keybinding keybindings[] = {
 
 #define NUM_KEYBINDINGS (sizeof(keybindings) / sizeof(Keybinding))
 
+// Startup jobs
+// Started in parallel when moody starts, except that a job waits for the
+// jobs in its after list to be ready. When a job counts as ready:
+#define READY_STARTED 0 // As soon as it's running
+#define READY_EXITED 1  // When it exits successfully (setup commands)
+#define READY_DOCK 2    // When a dock (bar, panel) maps
+#define READY_WINDOW 3  // When a window of its own maps
+
+#define MAX_JOBS 32
+#define MAX_JOB_DEPS 8
+#define RESTART_BACKOFF_MIN 500    // ms before restarting a crashed job,
+#define RESTART_BACKOFF_MAX 30000  // doubled on every crash in a row
+#define RESTART_BACKOFF_RESET 10000 // ms a job has to stay up to be forgiven
+
+typedef struct {
+  const char *name;
+  const char *command;
+  const char *after; // Comma separated job names, NULL for none
+  int ready;         // READY_*
+  int restart;       // Start it again whenever it dies
+} StartupJob;
+
+static StartupJob startup_jobs[] = {
+    {"keyrepeat", "xset r rate 200", NULL, READY_EXITED, 0},
+    {"polybar", "~/.config/polybar/launch_polybar.sh", NULL, READY_DOCK, 0},
+};
+
+#define NUM_STARTUP_JOBS (sizeof(startup_jobs) / sizeof(StartupJob))
+
+// Pre-started instances
+// moody keeps this many instances of a command running with their windows
+// held back, so a binding that runs exactly that command only has to map
+// one. Only for programs that open a window and wait (terminals), not for
+// ones that grab the keyboard as soon as they start (rofi, dmenu)
+#define MAX_POOLS 8
+#define MAX_POOL_SIZE 4
+#define POOL_SPAWN_TIMEOUT 10000 // ms for an instance to bring up its window
+#define MAX_LAUNCHES 16 // Launches being timed at once
+
+typedef struct {
+  const char *command;
+  int size;
+} PoolCommand;
+
+static PoolCommand pool_commands[] = {
+    {"xterm", 1},
+};
+
+#define NUM_POOL_COMMANDS (sizeof(pool_commands) / sizeof(PoolCommand))
+
+// Freezing hidden workspaces
+// Processes whose windows are all on hidden workspaces picked here are
+// stopped (SIGSTOP) once the workspace has been hidden for FREEZE_GRACE ms,
+// and continued right before any of their windows is shown again. Saves the
+// CPU browsers and dashboards spend drawing for nobody. Off by default
+#define FREEZE_WORKSPACES 0 // Bit n for workspace n + 1, e.g. (1 << 8) for 9
+#define FREEZE_GRACE 10000  // ms
+#define MAX_FROZEN 64       // Processes stopped at once, over all displays
+
+// WM_CLASS classes that keep running anyway (players, terminals)
+static const char *freeze_exempt[] = {"mpv", "Spotify", "XTerm", "Alacritty",
+                                      "kitty"};
+
+#define NUM_FREEZE_EXEMPT (sizeof(freeze_exempt) / sizeof(freeze_exempt[0]))
+
 #endif
@@ -5,25 +5,107 @@
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
+#include <ctype.h>
 #include <err.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "structs.h"
+#include "trace.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define CLAMP(x, lo, hi) MIN(MAX(x, lo), hi)
 
 TilingLayout layout;
-WorkspaceManager workspace_manager;
-DockGeometry dock_geometry;
+
+// Displays
+// Every display is managed by a thread of its own, the first one by the main
+// thread. Anything about a display is thread local, the big parts are
+// allocated by its thread. Startup jobs are the process's and belong to the
+// first display
+const char *display_names[MAX_DISPLAYS];
+int display_wake_fds[MAX_DISPLAYS]; // eventfds to wake every display's loop
+int num_displays = 0;
+__thread int display_index = 0; // -1 on worker threads
+__thread char **spawn_env;      // environ with this display's DISPLAY
+
+__thread WorkspaceManager *workspace_manager;
+
+// Docks and the area they leave for everything else
+__thread Dock docks[MAX_DOCKS];
+__thread int num_docks = 0;
+__thread WorkArea work_area;
+__thread Config config;
+__thread Stats stats;
+__thread Worker *worker;
+Supervisor supervisor = {.child_fd = -1};
+__thread Pool pools[MAX_POOLS];
+__thread int num_pools = 0;
+__thread Launch launches[MAX_LAUNCHES];
+__thread int num_launches = 0;
+// Stopped processes of every display, so quitting can continue them all
+FrozenClient frozen[MAX_FROZEN];
+int num_frozen = 0;
+pthread_mutex_t frozen_lock = PTHREAD_MUTEX_INITIALIZER;
+volatile sig_atomic_t quit_requested = 0;
+
+// Moody is the source of truth for focus and geometry, so event handlers
+// never have to ask the server
+__thread Window focused_window = None;
+__thread PendingWindow pending_windows[MAX_PENDING_WINDOWS];
+__thread int num_pending_windows = 0;
+volatile sig_atomic_t stats_requested = 0; // Bumped by every SIGUSR1
+__thread sig_atomic_t stats_printed = 0;
+volatile sig_atomic_t clients_requested = 0; // Bumped by every SIGUSR2
+__thread sig_atomic_t clients_printed = 0;
+__thread ClientTable *client_table;
+
+// Config file watch
+__thread int inotify_fd = -1;
+__thread int config_dir_watch = -1; // -1 while the directory doesn't exist
+char config_path[PATH_MAX];
+const char *config_name; // basename of config_path
 
 // EWMH properties
-Atom net_supported, net_wm_name, net_supporting_wm_check, net_wm_state,
+__thread Atom net_supported, net_wm_name, net_supporting_wm_check, net_wm_state,
     net_wm_state_fullscreen, net_wm_desktop, net_client_list,
-    net_current_desktop, net_number_of_desktops, net_active_window;
+    net_current_desktop, net_number_of_desktops, net_active_window,
+    net_wm_state_hidden, net_wm_strut, net_wm_strut_partial, net_workarea,
+    net_wm_pid;
+
+// ICCCM properties
+__thread Atom wm_state, wm_protocols, wm_delete_window;
+
+// Window types
+__thread Atom net_wm_window_type, net_wm_window_type_dock, net_wm_window_type_dialog,
+    net_wm_window_type_utility, net_wm_window_type_toolbar,
+    net_wm_window_type_splash, net_wm_window_type_menu,
+    net_wm_window_type_dropdown_menu, net_wm_window_type_popup_menu,
+    net_wm_window_type_tooltip, net_wm_window_type_notification;
+
+long long now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
 
 // EWMH
 void init_ewmh_atoms(Display *dpy) {
@@ -37,6 +119,34 @@ void init_ewmh_atoms(Display *dpy) {
   net_current_desktop = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False);
   net_number_of_desktops = XInternAtom(dpy, "_NET_NUMBER_OF_DESKTOPS", False);
   net_active_window = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
+  net_wm_state_hidden = XInternAtom(dpy, "_NET_WM_STATE_HIDDEN", False);
+  net_wm_strut = XInternAtom(dpy, "_NET_WM_STRUT", False);
+  net_wm_strut_partial = XInternAtom(dpy, "_NET_WM_STRUT_PARTIAL", False);
+  net_workarea = XInternAtom(dpy, "_NET_WORKAREA", False);
+  net_wm_pid = XInternAtom(dpy, "_NET_WM_PID", False);
+  wm_state = XInternAtom(dpy, "WM_STATE", False);
+  wm_protocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
+  wm_delete_window = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
+
+  net_wm_window_type = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
+  net_wm_window_type_dock = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
+  net_wm_window_type_dialog =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
+  net_wm_window_type_utility =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_UTILITY", False);
+  net_wm_window_type_toolbar =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_TOOLBAR", False);
+  net_wm_window_type_splash =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_SPLASH", False);
+  net_wm_window_type_menu = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_MENU", False);
+  net_wm_window_type_dropdown_menu =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU", False);
+  net_wm_window_type_popup_menu =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_POPUP_MENU", False);
+  net_wm_window_type_tooltip =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_TOOLTIP", False);
+  net_wm_window_type_notification =
+      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_NOTIFICATION", False);
 }
 
 void set_supported_atoms(Display *dpy, Window root) {
@@ -46,6 +156,8 @@ void set_supported_atoms(Display *dpy, Window root) {
       net_wm_state_fullscreen, net_wm_desktop,
       net_client_list,         net_current_desktop,
       net_number_of_desktops,  net_active_window,
+      net_wm_state_hidden,     net_wm_strut,
+      net_wm_strut_partial,    net_workarea,
   };
 
   XChangeProperty(dpy, root, net_supported, XA_ATOM, 32, PropModeReplace,
@@ -82,6 +194,28 @@ void set_window_state(Window window, Atom state, bool add, Display *dpy) {
              SubstructureNotifyMask | SubstructureRedirectMask, &e);
 }
 
+// Mirrors the state moody keeps about a window into _NET_WM_STATE
+void update_net_wm_state(Display *dpy, WindowInfo *info) {
+  Atom states[2];
+  int count = 0;
+
+  if (info->is_fullscreen) {
+    states[count++] = net_wm_state_fullscreen;
+  }
+  if (info->is_hidden) {
+    states[count++] = net_wm_state_hidden;
+  }
+
+  XChangeProperty(dpy, info->window, net_wm_state, XA_ATOM, 32,
+                  PropModeReplace, (unsigned char *)states, count);
+}
+
+void set_wm_state(Display *dpy, Window win, long state) {
+  long data[] = {state, None};
+  XChangeProperty(dpy, win, wm_state, wm_state, 32, PropModeReplace,
+                  (unsigned char *)data, 2);
+}
+
 void set_active_window(Display *dpy, Window root, Window active_window) {
   XChangeProperty(dpy, root, net_active_window, XA_WINDOW, 32, PropModeReplace,
                   (unsigned char *)&active_window, 1);
@@ -121,208 +255,2849 @@ void init_ewmh(Display *dpy, Window root) {
   set_current_desktop(dpy, root, 0);
 }
 
-// Status bar
-bool is_dock_window(Display *dpy, Window win) {
-  Atom actual_type;
-  int actual_format;
-  unsigned long nitems, bytes_after;
-  Atom *props = NULL;
-  bool result = false;
+// Client lookup
+WindowInfo *find_window_info(TilingLayout *layout, Window window) {
+  for (int i = 0; i < layout->count; i++) {
+    if (layout->windows[i].window == window) {
+      return &layout->windows[i];
+    }
+  }
+  return NULL;
+}
 
-  Atom net_wm_window_type = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-  Atom net_wm_window_type_dock =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
+// Geometry of windows that aren't managed yet, from CreateNotify and
+// ConfigureNotify, so mapping them doesn't need XGetWindowAttributes
+PendingWindow *find_pending_window(Window window) {
+  for (int i = 0; i < num_pending_windows; i++) {
+    if (pending_windows[i].window == window) {
+      return &pending_windows[i];
+    }
+  }
+  return NULL;
+}
 
-  if (XGetWindowProperty(dpy, win, net_wm_window_type, 0, (~0L), False, XA_ATOM,
-                         &actual_type, &actual_format, &nitems, &bytes_after,
-                         (unsigned char **)&props) == Success) {
-    if (actual_type == XA_ATOM && actual_format == 32) {
-      for (unsigned long i = 0; i < nitems; i++) {
-        if (props[i] == net_wm_window_type_dock) {
-          result = true;
-          break;
-        }
-      }
+void add_pending_window(XCreateWindowEvent *ev) {
+  PendingWindow *pending = find_pending_window(ev->window);
+  if (!pending) {
+    if (num_pending_windows == MAX_PENDING_WINDOWS) {
+      // Forget the oldest, it'll just fall back to a round trip
+      memmove(&pending_windows[0], &pending_windows[1],
+              sizeof(PendingWindow) * (MAX_PENDING_WINDOWS - 1));
+      num_pending_windows--;
     }
-    if (props) {
-      XFree(props);
+    pending = &pending_windows[num_pending_windows++];
+    pending->activity = (ClientActivity){0};
+  }
+
+  pending->window = ev->window;
+  pending->x = ev->x;
+  pending->y = ev->y;
+  pending->width = ev->width;
+  pending->height = ev->height;
+  pending->override_redirect = ev->override_redirect;
+}
+
+void remove_pending_window(Window window) {
+  PendingWindow *pending = find_pending_window(window);
+  if (pending) {
+    *pending = pending_windows[--num_pending_windows];
+  }
+}
+
+// Fills in the geometry of a window, asking the server only if moody has
+// never seen it before (e.g. it was created before moody started)
+void get_window_geometry(Display *dpy, Window window, int *x, int *y,
+                         int *width, int *height) {
+  WindowInfo *info = NULL;
+  for (int w = 0; w < MAX_WORKSPACES && !info; w++) {
+    info = find_window_info(&workspace_manager->layouts[w], window);
+  }
+  if (info) {
+    *x = info->x;
+    *y = info->y;
+    *width = info->width;
+    *height = info->height;
+    return;
+  }
+
+  PendingWindow *pending = find_pending_window(window);
+  if (pending) {
+    *x = pending->x;
+    *y = pending->y;
+    *width = pending->width;
+    *height = pending->height;
+    return;
+  }
+
+  XWindowAttributes attr;
+  XGetWindowAttributes(dpy, window, &attr);
+  *x = attr.x;
+  *y = attr.y;
+  *width = attr.width;
+  *height = attr.height;
+}
+
+// Wakeups
+// The eventfd counter only fails to move if it's about to overflow, in
+// which case the other side has plenty of wakeups queued already
+static void wake(int fd) {
+  uint64_t one = 1;
+  ssize_t written = write(fd, &one, sizeof(one));
+  (void)written;
+}
+
+static void drain(int fd) {
+  uint64_t count;
+  ssize_t got = read(fd, &count, sizeof(count));
+  (void)got;
+}
+
+// Spawning
+extern char **environ;
+
+// Runs a shell command in its own process group, so windows of anything it
+// starts can be traced back to it, and with none of moody's blocked signals.
+// moody reaps it when it exits. Returns its pid, which is also the group, or
+// -1
+pid_t spawn_command(const char *command) {
+  posix_spawnattr_t attr;
+  sigset_t no_signals;
+  sigemptyset(&no_signals);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &no_signals);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                      POSIX_SPAWN_SETSIGMASK);
+
+  pid_t pid;
+  char *argv[] = {"sh", "-c", (char *)command, NULL};
+  int error = posix_spawn(&pid, "/bin/sh", NULL, &attr, argv,
+                          spawn_env ? spawn_env : environ);
+  posix_spawnattr_destroy(&attr);
+  if (error) {
+    fprintf(stderr, "Couldn't run %s: %s\n", command, strerror(error));
+    return -1;
+  }
+  return pid;
+}
+
+// Startup jobs
+// Instead of a shell script that starts things one after the other, moody
+// starts every job whose dependencies are ready at once, restarts crashed
+// ones with a backoff and knows when the whole session is up
+
+static void handle_sigchld(int sig) {
+  int saved_errno = errno;
+  wake(supervisor.child_fd);
+  errno = saved_errno;
+}
+
+static int find_job(const char *name) {
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    if (strcmp(supervisor.jobs[i].name, name) == 0) {
+      return i;
     }
   }
+  return -1;
+}
 
-  return result;
+static long long ms_since_start(long long when) {
+  return (when - supervisor.started) / 1000000;
 }
 
-void update_dock_geometry(Display *dpy, Window win) {
-  XWindowAttributes attrs;
-  XGetWindowAttributes(dpy, win, &attrs);
+void launch_job(Job *job) {
+  job->pid = spawn_command(job->command);
+  job->launched = true;
+  job->restart_at = 0;
+  job->started_at = now_ns();
+  if (job->pid < 0) {
+    fprintf(stderr, "Couldn't start job %s\n", job->name);
+    job->pid = 0;
+    job->failed = true;
+    return;
+  }
+  job->group = job->pid;
+  printf("Started job %s (pid %d)\n", job->name, job->pid);
+}
 
-  dock_geometry.x = attrs.x;
-  dock_geometry.y = attrs.y;
-  dock_geometry.width = attrs.width;
-  dock_geometry.height = attrs.height;
+static void note_job_ready(Job *job) {
+  job->ready = true;
+  printf("Job %s ready after %lld ms\n", job->name, ms_since_start(now_ns()));
 }
 
-// Window decorations
-void hex_to_rgb(const char *hex, XColor *color, Display *dpy) {
-  unsigned int r, g, b;
-  if (sscanf(hex, "#%02x%02x%02x", &r, &g, &b) != 3) {
-    fprintf(stderr, "Invalid color format: %s\n", hex);
+void check_session_ready() {
+  if (stats.session_ready_ns) {
     return;
   }
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    if (!supervisor.jobs[i].ready) {
+      return;
+    }
+  }
 
-  color->red = r * 257;   // Scale up to 16-bit
-  color->green = g * 257; // Scale up to 16-bit
-  color->blue = b * 257;  // Scale up to 16-bit
-  color->flags = DoRed | DoGreen | DoBlue;
-  XAllocColor(dpy, DefaultColormap(dpy, DefaultScreen(dpy)), color);
+  stats.session_ready_ns = MAX(1, now_ns() - supervisor.started);
+  printf("Session ready in %lld ms\n", stats.session_ready_ns / 1000000);
 }
 
-void draw_window_border(Display *dpy, Window window, int border_width,
-                        const char *color_hex) {
-  XColor color;
-  hex_to_rgb(color_hex, &color, dpy);
+// Starts every job that hasn't run yet and whose dependencies are ready,
+// until that doesn't make any more jobs ready
+void launch_jobs() {
+  bool became_ready;
+  do {
+    became_ready = false;
+    for (int i = 0; i < supervisor.num_jobs; i++) {
+      Job *job = &supervisor.jobs[i];
+      if (job->launched) {
+        continue;
+      }
 
-  XSetWindowBorder(dpy, window, color.pixel);
-  XSetWindowBorderWidth(dpy, window, border_width);
+      bool deps_ready = true;
+      for (int d = 0; d < job->num_deps; d++) {
+        deps_ready = deps_ready && supervisor.jobs[job->deps[d]].ready;
+      }
+      if (!deps_ready) {
+        continue;
+      }
+
+      launch_job(job);
+      if (job->pid && job->ready_when == READY_STARTED) {
+        note_job_ready(job);
+        became_ready = true;
+      }
+    }
+  } while (became_ready);
+
+  check_session_ready();
 }
 
-// Focus window
-void focus_window(Display *dpy, Window window) {
-  TilingLayout *current_workspace =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
+void mark_job_ready(Job *job) {
+  if (!job->ready) {
+    note_job_ready(job);
+    launch_jobs();
+  }
+}
+
+void start_supervisor(const Config *cfg) {
+  supervisor.started = now_ns();
+  supervisor.child_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  struct sigaction sa = {.sa_handler = handle_sigchld,
+                         .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+
+  for (int i = 0; i < cfg->num_jobs; i++) {
+    if (supervisor.num_jobs == MAX_JOBS) {
+      fprintf(stderr, "Job limit exceeded, not starting %s\n",
+              cfg->jobs[i].name);
+      continue;
+    }
+    Job *job = &supervisor.jobs[supervisor.num_jobs++];
+    job->name = strdup(cfg->jobs[i].name);
+    job->command = strdup(cfg->jobs[i].command);
+    job->ready_when = cfg->jobs[i].ready;
+    job->restart = cfg->jobs[i].restart;
+  }
+
+  // Dependencies can only be resolved once every job is known
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    if (!cfg->jobs[i].after) {
+      continue;
+    }
+
+    Job *job = &supervisor.jobs[i];
+    char *after = strdup(cfg->jobs[i].after);
+    char *saveptr;
+    for (char *name = strtok_r(after, ",", &saveptr); name;
+         name = strtok_r(NULL, ",", &saveptr)) {
+      int dep = find_job(name);
+      if (dep < 0 || dep == i || job->num_deps == MAX_JOB_DEPS) {
+        fprintf(stderr, "Job %s can't come after '%s'\n", job->name, name);
+        continue;
+      }
+      job->deps[job->num_deps++] = dep;
+    }
+    free(after);
+  }
 
-  if (is_dock_window(dpy, window)) {
+  launch_jobs();
+}
+
+// Milliseconds until the next scheduled restart, -1 if there is none
+int supervisor_timeout() {
+  long long next = 0;
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    long long at = supervisor.jobs[i].restart_at;
+    if (at && (!next || at < next)) {
+      next = at;
+    }
+  }
+  if (!next) {
+    return -1;
+  }
+  return MAX(0, (next - now_ns() + 999999) / 1000000);
+}
+
+static void job_exited(Job *job, int status) {
+  long long now = now_ns();
+  bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  job->pid = 0;
+
+  if (job->ready_when == READY_EXITED && success) {
+    mark_job_ready(job);
+    return;
+  }
+  printf("Job %s exited with status %d after %lld ms\n", job->name,
+         WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+         (now - job->started_at) / 1000000);
+
+  if (!job->restart) {
+    // Launchers that fork and exit are fine, only a failed setup command
+    // means the job will never be ready
+    job->failed = job->ready_when == READY_EXITED;
     return;
   }
 
-  // Set inactive border color for all windows
-  for (int i = 0; i < current_workspace->count; i++) {
-    draw_window_border(dpy, current_workspace->windows[i].window, BORDER_WIDTH,
-                       INACTIVE_BORDER_COLOR);
+  if (now - job->started_at > RESTART_BACKOFF_RESET * 1000000LL) {
+    job->crashes = 0;
   }
+  long long delay = MIN((long long)RESTART_BACKOFF_MIN << MIN(job->crashes, 16),
+                        RESTART_BACKOFF_MAX);
+  job->crashes++;
+  job->restart_at = now + delay * 1000000LL;
+  printf("Restarting job %s in %lld ms\n", job->name, delay);
+}
 
-  // Focus window and set active border color
-  XSetInputFocus(dpy, window, RevertToPointerRoot, CurrentTime);
-  XRaiseWindow(dpy, window);
-  set_active_window(dpy, RootWindow(dpy, DefaultScreen(dpy)), window);
-  draw_window_border(dpy, window, BORDER_WIDTH, BORDER_COLOR);
+// Returns false if the pid isn't a job's
+bool reap_job(pid_t pid, int status) {
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    if (supervisor.jobs[i].pid == pid) {
+      job_exited(&supervisor.jobs[i], status);
+      return true;
+    }
+  }
+  return false;
+}
 
-  printf("Window 0x%lx focused\n", window);
+// Restarts the jobs that are due, after every wakeup
+void supervise_jobs() {
+  long long now = now_ns();
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    Job *job = &supervisor.jobs[i];
+    if (job->restart_at && now >= job->restart_at) {
+      launch_job(job);
+    }
+  }
 }
 
-void focus_next_window(Display *dpy) {
-  TilingLayout *current_layout =
-      &workspace_manager
-           .layouts[workspace_manager.current_workspace]; // get the current
-                                                          // workspace layout
-                                                          // struct
-  if (current_layout->count == 0)
-    return; // No windows
+// Docks don't say who started them, the first job waiting for one gets it
+void job_dock_mapped() {
+  if (display_index != 0) {
+    return;
+  }
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    Job *job = &supervisor.jobs[i];
+    if (job->ready_when == READY_DOCK && job->launched && !job->ready) {
+      mark_job_ready(job);
+      return;
+    }
+  }
+}
+
+void job_window_mapped(pid_t pid) {
+  if (display_index != 0) {
+    return;
+  }
+  pid_t group = pid > 0 ? getpgid(pid) : -1;
+  if (group <= 0) {
+    return;
+  }
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    Job *job = &supervisor.jobs[i];
+    if (job->ready_when == READY_WINDOW && job->group == group) {
+      mark_job_ready(job);
+    }
+  }
+}
 
-  Window focused_window;
-  int revert_to;
-  XGetInputFocus(dpy, &focused_window, &revert_to);
+// Instance pools
+// A terminal takes a while to start, so moody keeps instances of chosen
+// commands running with their windows held back. A binding that runs one of
+// those commands just maps a waiting window, and the pool is topped up again
+// in the background
 
-  int index = -1;
-  for (int i = 0; i < current_layout->count;
-       i++) { // loop through all windows in current workspace
-    if (current_layout->windows[i].window == focused_window) {
-      index = i;
-      break;
+void fill_pool(Pool *pool) {
+  if (pool->refill_at && now_ns() < pool->refill_at) {
+    return;
+  }
+  pool->refill_at = 0;
+
+  for (int i = 0; i < pool->size; i++) {
+    PoolInstance *instance = &pool->instances[i];
+    if (instance->pid) {
+      continue;
+    }
+    pid_t pid = spawn_command(pool->command);
+    if (pid < 0) {
+      return;
     }
+    *instance = (PoolInstance){.pid = pid, .spawned_at = now_ns()};
+    printf("Warming up %s (pid %d)\n", pool->command, pid);
   }
+}
 
-  if (index == -1) {
-    // Focused window not found in the list, default to the first window
-    index = 0;
-  } else {
-    // Focus the next window in the list
-    index = (index + 1) % current_layout->count;
+void start_pools(const Config *cfg) {
+  for (int i = 0; i < cfg->num_pools; i++) {
+    if (num_pools == MAX_POOLS) {
+      fprintf(stderr, "Pool limit exceeded, not warming up %s\n",
+              cfg->pools[i].command);
+      continue;
+    }
+    Pool *pool = &pools[num_pools++];
+    pool->command = strdup(cfg->pools[i].command);
+    pool->size = MIN(cfg->pools[i].size, MAX_POOL_SIZE);
+    fill_pool(pool);
+  }
+}
+
+// Instances shouldn't outlive moody, nobody could ever map them
+void stop_pools() {
+  for (int p = 0; p < num_pools; p++) {
+    for (int i = 0; i < pools[p].size; i++) {
+      if (pools[p].instances[i].pid) {
+        kill(-pools[p].instances[i].pid, SIGTERM);
+      }
+    }
   }
+}
 
-  Window next_window = current_layout->windows[index].window;
-  if (next_window) {
-    // Set border color for inactive window
-    draw_window_border(dpy, focused_window, BORDER_WIDTH,
-                       INACTIVE_BORDER_COLOR);
-    // Focus the next window and set active border
-    focus_window(dpy, next_window);
+// The pools changed in moodyrc. The old instances are stopped, held back
+// windows included, and the new pools warmed up from scratch
+void restart_pools(const Config *cfg) {
+  stop_pools();
+  for (int p = 0; p < num_pools; p++) {
+    free(pools[p].command);
   }
+  memset(pools, 0, sizeof(pools));
+  num_pools = 0;
+  start_pools(cfg);
 }
 
-void focus_prev_window(Display *dpy) {
-  TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
-  if (current_layout->count == 0)
-    return; // No windows to focus on
+bool pools_equal(const Config *a, const Config *b) {
+  if (a->num_pools != b->num_pools) {
+    return false;
+  }
+  for (int i = 0; i < a->num_pools; i++) {
+    if (a->pools[i].size != b->pools[i].size ||
+        strcmp(a->pools[i].command, b->pools[i].command) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  Window focused_window;
-  int revert_to;
-  XGetInputFocus(dpy, &focused_window, &revert_to);
+// Returns false if the pid isn't a pool instance's
+bool reap_pool_instance(pid_t pid) {
+  for (int p = 0; p < num_pools; p++) {
+    Pool *pool = &pools[p];
+    for (int i = 0; i < pool->size; i++) {
+      PoolInstance *instance = &pool->instances[i];
+      if (instance->pid != pid) {
+        continue;
+      }
 
-  int index = -1;
-  for (int i = 0; i < current_layout->count; i++) {
-    if (current_layout->windows[i].window == focused_window) {
-      index = i;
-      break;
+      // One that died before showing a window will likely do it again
+      if (instance->window == None) {
+        long long delay =
+            MIN((long long)RESTART_BACKOFF_MIN << MIN(pool->failures, 16),
+                RESTART_BACKOFF_MAX);
+        pool->failures++;
+        pool->refill_at = now_ns() + delay * 1000000LL;
+        fprintf(stderr, "%s exited without a window, retrying in %lld ms\n",
+                pool->command, delay);
+      }
+      *instance = (PoolInstance){0};
+      fill_pool(pool);
+      return true;
     }
   }
+  return false;
+}
 
-  if (index == -1) {
-    // Focused window not found in the list, default to the last window
-    index = current_layout->count - 1;
-  } else {
-    // Focus the previous window in the list
-    index = (index - 1 + current_layout->count) % current_layout->count;
+// Milliseconds until a pool needs attention, -1 if none does
+int pool_timeout() {
+  long long next = 0;
+  for (int p = 0; p < num_pools; p++) {
+    Pool *pool = &pools[p];
+    if (pool->refill_at && (!next || pool->refill_at < next)) {
+      next = pool->refill_at;
+    }
+    for (int i = 0; i < pool->size; i++) {
+      PoolInstance *instance = &pool->instances[i];
+      long long deadline =
+          instance->spawned_at + POOL_SPAWN_TIMEOUT * 1000000LL;
+      if (instance->pid && instance->window == None &&
+          (!next || deadline < next)) {
+        next = deadline;
+      }
+    }
+  }
+  if (!next) {
+    return -1;
   }
+  return MAX(0, (next - now_ns() + 999999) / 1000000);
+}
 
-  Window prev_window = current_layout->windows[index].window;
-  if (prev_window) {
-    draw_window_border(dpy, focused_window, BORDER_WIDTH,
-                       INACTIVE_BORDER_COLOR);
-    // Focus the previous window and set active border
-    focus_window(dpy, prev_window);
+// Gives up on instances that never brought up a window and refills the
+// pools whose backoff is over
+void maintain_pools() {
+  long long now = now_ns();
+  for (int p = 0; p < num_pools; p++) {
+    Pool *pool = &pools[p];
+    for (int i = 0; i < pool->size; i++) {
+      PoolInstance *instance = &pool->instances[i];
+      if (instance->pid && instance->window == None &&
+          now - instance->spawned_at > POOL_SPAWN_TIMEOUT * 1000000LL) {
+        fprintf(stderr, "%s never showed a window, killing it\n",
+                pool->command);
+        kill(-instance->pid, SIGTERM);
+        instance->spawned_at = now; // Once is enough, reaping clears it
+      }
+    }
+    if (pool->refill_at && now >= pool->refill_at) {
+      fill_pool(pool);
+    }
   }
 }
 
-// Tiling functions
-void init_layout() {
-  layout.count = 0;
-  layout.master = None;
+bool pool_waiting_for_window() {
+  for (int p = 0; p < num_pools; p++) {
+    for (int i = 0; i < pools[p].size; i++) {
+      if (pools[p].instances[i].pid && pools[p].instances[i].window == None) {
+        return true;
+      }
+    }
+  }
+  return false;
 }
 
-bool is_floating_window(Display *dpy, Window win) {
-  Atom actual_type;
-  int actual_format;
-  unsigned long nitems, bytes_after;
-  Atom *props = NULL;
-  bool result = false;
+// A window that wants to be mapped, if one of the instances started it the
+// pool keeps it unmapped. Returns true if so
+bool pool_hold_window(Window window, pid_t group,
+                      const WindowProperties *props) {
+  for (int p = 0; p < num_pools; p++) {
+    Pool *pool = &pools[p];
+    for (int i = 0; i < pool->size; i++) {
+      PoolInstance *instance = &pool->instances[i];
+      if (instance->pid == group && instance->window == None) {
+        instance->window = window;
+        instance->properties = *props;
+        pool->failures = 0;
+        printf("%s is warm (window 0x%lx)\n", pool->command, window);
+        return true;
+      }
+    }
+  }
+  return false;
+}
 
-  Atom net_wm_window_type = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-  Atom net_wm_window_type_dialog =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-  Atom net_wm_window_type_utility =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_UTILITY", False);
-  Atom net_wm_window_type_toolbar =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_TOOLBAR", False);
-  Atom net_wm_window_type_splash =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_SPLASH", False);
-  Atom net_wm_window_type_menu =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_MENU", False);
-  Atom net_wm_window_type_dropdown_menu =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU", False);
-  Atom net_wm_window_type_popup_menu =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_POPUP_MENU", False);
-  Atom net_wm_window_type_tooltip =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_TOOLTIP", False);
-  Atom net_wm_window_type_notification =
-      XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_NOTIFICATION", False);
+// The window of a ready instance of command, taken out of the pool, or None.
+// Managing it needs no round trip, props is what was read when it showed up
+Window pool_take(const char *command, WindowProperties *props) {
+  for (int p = 0; p < num_pools; p++) {
+    Pool *pool = &pools[p];
+    if (strcmp(pool->command, command) != 0) {
+      continue;
+    }
+    for (int i = 0; i < pool->size; i++) {
+      PoolInstance *instance = &pool->instances[i];
+      if (instance->window != None) {
+        Window window = instance->window;
+        *props = instance->properties;
+        *instance = (PoolInstance){0};
+        fill_pool(pool);
+        stats.pool_hits++;
+        return window;
+      }
+    }
+    stats.pool_misses++;
+  }
+  return None;
+}
+
+// A held back window that went away takes its instance with it, the slot is
+// refilled right away since it did manage to start
+void pool_window_destroyed(Window window) {
+  for (int p = 0; p < num_pools; p++) {
+    for (int i = 0; i < pools[p].size; i++) {
+      PoolInstance *instance = &pools[p].instances[i];
+      if (instance->window == window) {
+        kill(-instance->pid, SIGTERM);
+        *instance = (PoolInstance){0};
+        fill_pool(&pools[p]);
+      }
+    }
+  }
+}
+
+// Launch latency
+void track_launch(Window window, pid_t group, bool warm) {
+  if (num_launches == MAX_LAUNCHES) {
+    return;
+  }
+  launches[num_launches++] = (Launch){
+      .window = window, .group = group, .pressed_at = now_ns(), .warm = warm};
+}
+
+// Cold launches are only known by process group until their window shows up
+bool launch_waiting_for_window() {
+  for (int i = 0; i < num_launches; i++) {
+    if (launches[i].window == None) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void match_launch(Window window, pid_t group) {
+  for (int i = 0; i < num_launches; i++) {
+    if (launches[i].window == None && launches[i].group == group) {
+      launches[i].window = window;
+      return;
+    }
+  }
+}
+
+// MapNotify, the window is on screen
+void launch_visible(Window window) {
+  long long now = now_ns();
+  for (int i = 0; i < num_launches; i++) {
+    Launch *launch = &launches[i];
+    if (launch->window != window) {
+      continue;
+    }
+
+    long long elapsed = now - launch->pressed_at;
+    if (launch->warm) {
+      stats.warm_launches++;
+      stats.warm_launch_ns += elapsed;
+    } else {
+      stats.cold_launches++;
+      stats.cold_launch_ns += elapsed;
+    }
+    printf("Window 0x%lx visible %lld us after the keypress (%s)\n", window,
+           elapsed / 1000, launch->warm ? "warm" : "cold");
+    launches[i] = launches[--num_launches];
+    return;
+  }
+}
+
+// Launches that never showed a window (scripts, commands without one)
+void expire_launches() {
+  long long now = now_ns();
+  for (int i = 0; i < num_launches; i++) {
+    if (now - launches[i].pressed_at > POOL_SPAWN_TIMEOUT * 1000000LL) {
+      launches[i--] = launches[--num_launches];
+    }
+  }
+}
+
+void reap_children() {
+  drain(supervisor.child_fd);
+  pid_t pid;
+  int status;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    if (!reap_job(pid, status)) {
+      reap_pool_instance(pid);
+    }
+  }
+}
+
+// Process accounting
+// Reads /proc/<pid>/stat. Returns false if the process is gone
+bool read_process_stat(pid_t pid, ProcessStat *stat) {
+  char path[64], buf[512];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+  size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+  fclose(file);
+  buf[len] = '\0';
+
+  // The command in parentheses can have spaces and parentheses itself
+  char *rest = strrchr(buf, ')');
+  unsigned long long utime, stime;
+  long rss_pages;
+  int pgrp;
+  if (!rest || sscanf(rest + 2,
+                      "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+                      "%*d %*d %*d %*d %*d %*d %*u %*u %ld",
+                      &pgrp, &utime, &stime, &rss_pages) != 4) {
+    return false;
+  }
+  stat->group = pgrp;
+  stat->cpu_ticks = utime + stime;
+  stat->rss_kb = rss_pages * (sysconf(_SC_PAGESIZE) / 1024);
+  return true;
+}
+
+// CPU time of a process, or of a whole process group for -group (a pass
+// over /proc). -1 if there's nothing left of it
+long long process_cpu_ticks(pid_t target) {
+  ProcessStat stat;
+  if (target > 0) {
+    return read_process_stat(target, &stat) ? stat.cpu_ticks : -1;
+  }
+
+  DIR *proc = opendir("/proc");
+  if (!proc) {
+    return -1;
+  }
+  long long total = -1;
+  struct dirent *entry;
+  while ((entry = readdir(proc))) {
+    pid_t pid = atoi(entry->d_name);
+    if (pid > 0 && read_process_stat(pid, &stat) && stat.group == -target) {
+      total = (total < 0 ? 0 : total) + stat.cpu_ticks;
+    }
+  }
+  closedir(proc);
+  return total;
+}
+
+// Freezing hidden workspaces
+// On the workspaces in config.freeze_workspaces, once one has been hidden for
+// config.freeze_grace ms, the processes with no window anywhere it could be
+// seen are stopped. They're continued before their windows are shown again.
+// A process that leads its process group (anything spawn_command started) is
+// stopped with the group, a browser's content processes are in there too, but
+// only if every window of the group is hidden and none of them is exempt
+bool freezes_workspace(int workspace) {
+  return config.freeze_workspaces & (1u << workspace);
+}
+
+// The process of a window that may be stopped, 0 if it isn't known yet, runs
+// on another machine or its class is exempt
+pid_t freezable_pid(WindowInfo *info) {
+  // The worker only reads /proc for local clients
+  if (!info->has_details || info->details.pid <= 0 ||
+      !info->details.command[0] || info->details.pid == getpid()) {
+    return 0;
+  }
+  for (int i = 0; i < config.num_freeze_exempt; i++) {
+    if (strcmp(info->details.wm_class, config.freeze_exempt[i]) == 0) {
+      return 0;
+    }
+  }
+  return info->details.pid;
+}
+
+// Index into frozen of what stopped the process, on its own or with its
+// group, -1 if this display didn't stop it. Takes frozen_lock
+int find_frozen(pid_t pid) {
+  pid_t group = getpgid(pid);
+  for (int i = 0; i < num_frozen; i++) {
+    if (frozen[i].display == display_index &&
+        (frozen[i].pid == pid || (group > 0 && frozen[i].target == -group))) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Continues the process, frozen_lock held
+void thaw_frozen(int index) {
+  FrozenClient *client = &frozen[index];
+  kill(client->target, SIGCONT);
+
+  long long stopped = now_ns() - client->frozen_at;
+  stats.processes_thawed++;
+  stats.frozen_ns += stopped;
+  stats.cpu_saved_ns += client->cpu_share * stopped;
+  printf("Continued pid %d after %lld s\n", client->pid,
+         stopped / 1000000000LL);
+  frozen[index] = frozen[--num_frozen];
+}
+
+// Right before the workspace is shown
+void thaw_workspace(TilingLayout *layout) {
+  pthread_mutex_lock(&frozen_lock);
+  for (int i = 0; i < layout->count && num_frozen > 0; i++) {
+    WindowInfo *info = &layout->windows[i];
+    int index = info->has_details ? find_frozen(info->details.pid) : -1;
+    if (index >= 0) {
+      thaw_frozen(index);
+    }
+  }
+  pthread_mutex_unlock(&frozen_lock);
+}
+
+// Quitting, or the freeze settings changed. Every display's when quitting
+void thaw_all(bool every_display) {
+  pthread_mutex_lock(&frozen_lock);
+  for (int i = num_frozen - 1; i >= 0; i--) {
+    if (every_display || frozen[i].display == display_index) {
+      thaw_frozen(i);
+    }
+  }
+  pthread_mutex_unlock(&frozen_lock);
+}
+
+// A stopped process whose last window went away (killed from outside) would
+// stay stopped with nothing to show
+void thaw_if_windowless(pid_t pid) {
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    for (int i = 0; i < layout->count; i++) {
+      if (layout->windows[i].has_details &&
+          layout->windows[i].details.pid == pid) {
+        return;
+      }
+    }
+  }
+  // Its group's other windows may still be hidden
+  pthread_mutex_lock(&frozen_lock);
+  int index = find_frozen(pid);
+  if (index >= 0 && frozen[index].pid == pid) {
+    thaw_frozen(index);
+  }
+  pthread_mutex_unlock(&frozen_lock);
+}
+
+// Whether every window of the process is on a freezing workspace that's past
+// its grace period
+bool process_hidden(pid_t pid, long long now) {
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    bool hidden = w != workspace_manager->current_workspace &&
+                  freezes_workspace(w) && layout->hidden_since &&
+                  now - layout->hidden_since >= config.freeze_grace * 1000000LL;
+    for (int i = 0; i < layout->count && !hidden; i++) {
+      if (layout->windows[i].has_details &&
+          layout->windows[i].details.pid == pid) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Whether the process group can be stopped as a whole: every window of its
+// members is one that could be stopped on its own. Windows that can't be
+// told apart yet (no details, a local client without _NET_WM_PID) could be
+// in it, so they keep it running
+bool group_freezable(pid_t group, long long now) {
+  char hostname[HOST_NAME_MAX + 1] = "";
+  gethostname(hostname, sizeof(hostname));
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    for (int i = 0; i < layout->count; i++) {
+      WindowInfo *info = &layout->windows[i];
+      if (!info->has_details) {
+        return false;
+      }
+      if (!info->details.command[0]) {
+        if (!info->details.machine[0] ||
+            strcmp(info->details.machine, hostname) == 0) {
+          return false;
+        }
+        continue; // Another machine's
+      }
+      if (getpgid(info->details.pid) == group &&
+          (!freezable_pid(info) || !process_hidden(info->details.pid, now))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// What gets SIGSTOP, -pid for the whole group
+pid_t freeze_target(pid_t pid, long long now) {
+  return getpgid(pid) == pid && group_freezable(pid, now) ? -pid : pid;
+}
+
+// CPU time of the workspace's processes just after it was hidden, what they
+// use from there until they're stopped is what stopping them saves
+void sample_hidden_workspace(TilingLayout *layout) {
+  for (int i = 0; i < layout->count; i++) {
+    WindowInfo *info = &layout->windows[i];
+    pid_t pid = freezable_pid(info);
+    info->hidden_cpu_ticks = -1;
+    info->hidden_group_ticks = -1;
+    for (int j = 0; j < i && pid; j++) {
+      if (layout->windows[j].has_details &&
+          layout->windows[j].details.pid == pid) {
+        info->hidden_cpu_ticks = layout->windows[j].hidden_cpu_ticks;
+        info->hidden_group_ticks = layout->windows[j].hidden_group_ticks;
+        pid = 0;
+      }
+    }
+    // Whether it'll be stopped alone or with its group is only known once
+    // the grace period is over, so both
+    if (pid) {
+      info->hidden_cpu_ticks = process_cpu_ticks(pid);
+      if (getpgid(pid) == pid) {
+        info->hidden_group_ticks = process_cpu_ticks(-pid);
+      }
+    }
+  }
+  layout->sampled_at = now_ns();
+}
+
+void freeze_workspace(TilingLayout *layout, long long now) {
+  double seconds = (now - layout->sampled_at) / 1e9;
+  pthread_mutex_lock(&frozen_lock);
+  for (int i = 0; i < layout->count && num_frozen < MAX_FROZEN; i++) {
+    WindowInfo *info = &layout->windows[i];
+    pid_t pid = freezable_pid(info);
+    if (!pid || info->hidden_cpu_ticks < 0 || find_frozen(pid) >= 0 ||
+        !process_hidden(pid, now)) {
+      continue;
+    }
+
+    pid_t target = freeze_target(pid, now);
+    if (target < 0 && info->hidden_group_ticks < 0) {
+      target = pid; // Wasn't leading its group when it was sampled
+    }
+    long long sampled =
+        target < 0 ? info->hidden_group_ticks : info->hidden_cpu_ticks;
+    long long ticks = process_cpu_ticks(target);
+    if (ticks < 0 || kill(target, SIGSTOP) != 0) {
+      continue;
+    }
+    double share = seconds > 0 ? (ticks - sampled) /
+                                     (double)sysconf(_SC_CLK_TCK) / seconds
+                               : 0;
+    frozen[num_frozen++] = (FrozenClient){.display = display_index,
+                                          .pid = pid,
+                                          .target = target,
+                                          .frozen_at = now,
+                                          .cpu_share = MAX(share, 0)};
+    stats.processes_frozen++;
+    printf("Stopped %s (pid %d%s), it used %.1f%% CPU while hidden\n",
+           info->details.command, pid, target < 0 ? " and its group" : "",
+           share * 100);
+  }
+  pthread_mutex_unlock(&frozen_lock);
+  layout->frozen = true;
+}
+
+// Milliseconds until a hidden workspace needs sampling or freezing, -1 if
+// none does
+int freeze_timeout() {
+  long long next = 0;
+  for (int w = 0; w < MAX_WORKSPACES && config.freeze_workspaces; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    if (w == workspace_manager->current_workspace || !freezes_workspace(w) ||
+        !layout->hidden_since || layout->frozen) {
+      continue;
+    }
+    if (!layout->sampled_at) {
+      return 0;
+    }
+    long long deadline =
+        layout->hidden_since + config.freeze_grace * 1000000LL;
+    if (!next || deadline < next) {
+      next = deadline;
+    }
+  }
+  if (!next) {
+    return -1;
+  }
+  return MAX(0, (next - now_ns() + 999999) / 1000000);
+}
+
+// After every wakeup. Sampling and stopping happen here, never in the middle
+// of a workspace switch
+void maintain_freezes() {
+  long long now = now_ns();
+  for (int w = 0; w < MAX_WORKSPACES && config.freeze_workspaces; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    if (w == workspace_manager->current_workspace || !freezes_workspace(w) ||
+        !layout->hidden_since || layout->frozen) {
+      continue;
+    }
+    if (!layout->sampled_at) {
+      sample_hidden_workspace(layout);
+    }
+    if (now - layout->hidden_since >= config.freeze_grace * 1000000LL) {
+      freeze_workspace(layout, now);
+    }
+  }
+}
+
+// The workspace was just hidden, or got a window while hidden
+void restart_freeze_grace(TilingLayout *layout) {
+  layout->hidden_since = now_ns();
+  layout->sampled_at = 0;
+  layout->frozen = false;
+}
+
+// Client accounting
+// What every client asks of moody (configure requests, maps, property
+// changes) is kept per client rather than per window, so one that keeps
+// opening short lived windows still adds up. Until the worker says whose a
+// window is, its activity waits in the window. Every CLIENT_SAMPLE_INTERVAL
+// ms the local clients' processes are read from /proc, and the ones that are
+// gone are dropped. kill -USR2 prints the table, to find the client flooding
+// moody or the machine
+void init_clients() {
+  client_table = calloc(1, sizeof(ClientTable));
+  if (!client_table) {
+    errx(1, "Couldn't allocate the client table");
+  }
+  // The first record collects what can't be put down to a client
+  client_table->clients[0].cpu_share = -1;
+  client_table->num_clients = 1;
+}
+
+bool is_local_client(ClientRecord *client) {
+  // The worker only fills in the command for local clients
+  return client->pid > 0 && client->command[0];
+}
+
+unsigned long total_activity(const ClientActivity *activity) {
+  return activity->configure_requests + activity->map_requests +
+         activity->property_changes;
+}
+
+void add_activity(ClientActivity *to, const ClientActivity *from) {
+  to->configure_requests += from->configure_requests;
+  to->map_requests += from->map_requests;
+  to->property_changes += from->property_changes;
+}
+
+bool is_client_of(ClientRecord *client, WindowInfo *info) {
+  return info->has_details && info->details.pid == client->pid &&
+         strcmp(info->details.machine, client->machine) == 0;
+}
+
+bool client_has_windows(ClientRecord *client) {
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    for (int i = 0; i < layout->count; i++) {
+      if (is_client_of(client, &layout->windows[i])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// The record of a window's client, added if it's new. When the table is full
+// the quietest client with no windows left makes room, NULL if there's none
+ClientRecord *find_client(ClientDetails *details) {
+  for (int i = 0; i < client_table->num_clients; i++) {
+    ClientRecord *client = &client_table->clients[i];
+    if (client->pid == details->pid &&
+        strcmp(client->machine, details->machine) == 0) {
+      return client;
+    }
+  }
+
+  int slot = client_table->num_clients;
+  if (slot == MAX_CLIENTS) {
+    slot = -1;
+    for (int i = 1; i < MAX_CLIENTS; i++) {
+      ClientRecord *client = &client_table->clients[i];
+      if (!client_has_windows(client) &&
+          (slot < 0 ||
+           total_activity(&client->activity) <
+               total_activity(&client_table->clients[slot].activity))) {
+        slot = i;
+      }
+    }
+    if (slot < 0) {
+      return NULL;
+    }
+  } else {
+    client_table->num_clients++;
+  }
+
+  ClientRecord *client = &client_table->clients[slot];
+  *client = (ClientRecord){.pid = details->pid, .cpu_share = -1};
+  snprintf(client->machine, sizeof(client->machine), "%s", details->machine);
+  snprintf(client->command, sizeof(client->command), "%s", details->command);
+  snprintf(client->wm_class, sizeof(client->wm_class), "%s",
+           details->wm_class);
+  return client;
+}
+
+// Where a managed window's activity goes
+ClientActivity *window_activity(WindowInfo *info) {
+  ClientRecord *client = info->has_details ? find_client(&info->details) : NULL;
+  return client ? &client->activity : &info->activity;
+}
+
+// Where a window moody doesn't manage has its activity: the pending window
+// until it's managed, the shared record otherwise
+ClientActivity *unmanaged_activity(Window window) {
+  PendingWindow *pending = find_pending_window(window);
+  return pending ? &pending->activity : &client_table->clients[0].activity;
+}
+
+// A window that was never managed is gone
+void forget_pending_window(Window window) {
+  PendingWindow *pending = find_pending_window(window);
+  if (pending) {
+    add_activity(&client_table->clients[0].activity, &pending->activity);
+    remove_pending_window(window);
+  }
+}
+
+// A managed window is going away. If the worker hasn't said whose it was
+// yet, its activity waits for the answer
+void window_departed(WindowInfo *info) {
+  if (info->has_details || !total_activity(&info->activity)) {
+    return;
+  }
+  DepartedWindow *departed = client_table->departed;
+  if (client_table->num_departed == WORKER_QUEUE_SIZE) {
+    add_activity(&client_table->clients[0].activity, &departed[0].activity);
+    memmove(&departed[0], &departed[1],
+            sizeof(DepartedWindow) * (WORKER_QUEUE_SIZE - 1));
+    client_table->num_departed--;
+  }
+  departed[client_table->num_departed++] = (DepartedWindow){
+      .window = info->window,
+      .activity = info->activity,
+  };
+}
+
+// The worker answered for a window. Whatever it did so far is its client's
+void credit_client(ClientDetails *details, ClientActivity *activity) {
+  ClientRecord *client = find_client(details);
+  add_activity(client ? &client->activity : &client_table->clients[0].activity,
+               activity);
+  *activity = (ClientActivity){0};
+}
+
+// The answer for a window that's already gone
+void credit_departed_window(ClientDetails *details) {
+  for (int i = 0; i < client_table->num_departed; i++) {
+    if (client_table->departed[i].window == details->window) {
+      credit_client(details, &client_table->departed[i].activity);
+      client_table->departed[i] =
+          client_table->departed[--client_table->num_departed];
+      return;
+    }
+  }
+}
+
+// Milliseconds until the next sample, -1 if sampling is off
+int sample_timeout() {
+  if (!CLIENT_SAMPLE_INTERVAL) {
+    return -1;
+  }
+  long long next =
+      client_table->sampled_at + CLIENT_SAMPLE_INTERVAL * 1000000LL;
+  return MAX(0, (next - now_ns() + 999999) / 1000000);
+}
+
+// After every wakeup, reads each local client's process when a sample is due
+void sample_clients() {
+  long long now = now_ns();
+  if (!CLIENT_SAMPLE_INTERVAL ||
+      now - client_table->sampled_at < CLIENT_SAMPLE_INTERVAL * 1000000LL) {
+    return;
+  }
+  client_table->sampled_at = now;
+
+  long ticks_per_second = sysconf(_SC_CLK_TCK);
+  for (int i = 0; i < client_table->num_clients;) {
+    ClientRecord *client = &client_table->clients[i];
+    ProcessStat stat;
+    if (!is_local_client(client)) {
+      i++;
+      continue;
+    }
+    if (!read_process_stat(client->pid, &stat)) {
+      // Gone, its windows with it
+      *client = client_table->clients[--client_table->num_clients];
+      continue;
+    }
+
+    // A pid that was reused starts over
+    client->cpu_share = -1;
+    if (client->sampled_at && stat.cpu_ticks >= client->cpu_ticks) {
+      client->cpu_share = (double)(stat.cpu_ticks - client->cpu_ticks) /
+                          ticks_per_second /
+                          ((now - client->sampled_at) / 1e9);
+    }
+    client->cpu_ticks = stat.cpu_ticks;
+    client->sampled_at = now;
+    client->rss_kb = stat.rss_kb;
+    i++;
+  }
+}
+
+double row_cpu_share(const ClientRow *row) {
+  return row->client && row->client->sampled_at ? row->client->cpu_share : -1;
+}
+
+// Busiest first: CPU, then requests to moody
+int compare_client_rows(const void *a, const void *b) {
+  const ClientRow *x = a, *y = b;
+  double x_cpu = row_cpu_share(x), y_cpu = row_cpu_share(y);
+  if (x_cpu != y_cpu) {
+    return x_cpu < y_cpu ? 1 : -1;
+  }
+  unsigned long x_requests = total_activity(&x->activity);
+  unsigned long y_requests = total_activity(&y->activity);
+  return (x_requests < y_requests) - (x_requests > y_requests);
+}
+
+void print_clients() {
+  int managed = 0;
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    managed += workspace_manager->layouts[w].count;
+  }
+  ClientRow *rows =
+      malloc((client_table->num_clients + managed) * sizeof(ClientRow));
+  if (!rows) {
+    return;
+  }
+
+  // A row per client, and one per window the worker hasn't answered for
+  int num_rows = client_table->num_clients;
+  for (int i = 0; i < num_rows; i++) {
+    ClientRecord *client = &client_table->clients[i];
+    rows[i] = (ClientRow){.client = client, .activity = client->activity};
+  }
+  // Windows gone before the worker answered for them are nobody's so far
+  for (int i = 0; i < client_table->num_departed; i++) {
+    add_activity(&rows[0].activity, &client_table->departed[i].activity);
+  }
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    TilingLayout *layout = &workspace_manager->layouts[w];
+    for (int i = 0; i < layout->count; i++) {
+      WindowInfo *info = &layout->windows[i];
+      ClientRow *row = NULL;
+      for (int r = 0; r < client_table->num_clients && !row; r++) {
+        if (is_client_of(rows[r].client, info)) {
+          row = &rows[r];
+        }
+      }
+      if (!row) {
+        row = &rows[num_rows++];
+        *row = (ClientRow){.window = info->window};
+      }
+      row->windows++;
+      add_activity(&row->activity, &info->activity);
+    }
+  }
+  qsort(rows, num_rows, sizeof(ClientRow), compare_client_rows);
+
+  flockfile(stdout);
+  printf("Clients on %s", display_names[display_index]);
+  if (client_table->sampled_at) {
+    printf(" (sampled %lld s ago)",
+           (now_ns() - client_table->sampled_at) / 1000000000LL);
+  }
+  printf(":\n  %-7s %-24s %7s %6s %9s %10s %5s %10s\n", "pid", "client",
+         "windows", "cpu%", "rss kB", "configures", "maps", "properties");
+  int printed = 0;
+  for (int r = 0; r < num_rows; r++) {
+    ClientRow *row = &rows[r];
+    ClientRecord *client = row->client;
+    if (!row->windows && !total_activity(&row->activity)) {
+      continue;
+    }
+
+    char pid[16] = "-", name[160], cpu[16] = "-", rss[24] = "-";
+    if (!client) {
+      snprintf(name, sizeof(name), "0x%lx", row->window);
+    } else if (is_local_client(client)) {
+      snprintf(pid, sizeof(pid), "%d", client->pid);
+      snprintf(name, sizeof(name), "%s", client->command);
+    } else if (client->machine[0]) {
+      snprintf(name, sizeof(name), "%s@%s",
+               client->wm_class[0] ? client->wm_class : "?",
+               client->machine);
+    } else {
+      snprintf(name, sizeof(name), "(unknown)");
+    }
+    if (row_cpu_share(row) >= 0) {
+      snprintf(cpu, sizeof(cpu), "%.1f", row_cpu_share(row) * 100);
+    }
+    if (client && client->sampled_at) {
+      snprintf(rss, sizeof(rss), "%ld", client->rss_kb);
+    }
+    printf("  %-7s %-24.24s %7d %6s %9s %10lu %5lu %10lu\n", pid, name,
+           row->windows, cpu, rss, row->activity.configure_requests,
+           row->activity.map_requests, row->activity.property_changes);
+    printed++;
+  }
+  if (!printed) {
+    printf("  no clients\n");
+  }
+  fflush(stdout);
+  funlockfile(stdout);
+  free(rows);
+}
+
+// Size hints
+// Read when the window is managed and by the worker whenever they change
+void read_size_hints(Display *dpy, Window window, SizeHints *hints) {
+  XSizeHints size;
+  long supplied;
+
+  memset(hints, 0, sizeof(SizeHints));
+  if (!XGetWMNormalHints(dpy, window, &size, &supplied)) {
+    return;
+  }
+
+  if (size.flags & PBaseSize) {
+    hints->base_width = size.base_width;
+    hints->base_height = size.base_height;
+  } else if (size.flags & PMinSize) {
+    hints->base_width = size.min_width;
+    hints->base_height = size.min_height;
+  }
+  if (size.flags & PResizeInc) {
+    hints->inc_width = size.width_inc;
+    hints->inc_height = size.height_inc;
+  }
+  if (size.flags & PMaxSize) {
+    hints->max_width = size.max_width;
+    hints->max_height = size.max_height;
+  }
+  if (size.flags & PMinSize) {
+    hints->min_width = size.min_width;
+    hints->min_height = size.min_height;
+  } else if (size.flags & PBaseSize) {
+    hints->min_width = size.base_width;
+    hints->min_height = size.base_height;
+  }
+  if (size.flags & PAspect && size.min_aspect.x && size.max_aspect.y) {
+    hints->min_aspect = (float)size.min_aspect.y / size.min_aspect.x;
+    hints->max_aspect = (float)size.max_aspect.x / size.max_aspect.y;
+  }
+}
+
+// Struts
+// Reads _NET_WM_STRUT_PARTIAL, or _NET_WM_STRUT for older docks. Takes the
+// atoms so the worker can read them on its own connection. Returns false if
+// the dock has neither
+bool read_strut(Display *dpy, Window window, Atom strut_partial,
+                Atom strut_atom, long strut[4]) {
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char *prop = NULL;
+
+  memset(strut, 0, 4 * sizeof(long));
+
+  Atom properties[] = {strut_partial, strut_atom};
+  for (int p = 0; p < 2; p++) {
+    if (XGetWindowProperty(dpy, window, properties[p], 0, 12, False,
+                           XA_CARDINAL, &actual_type, &actual_format, &nitems,
+                           &bytes_after, &prop) == Success &&
+        prop && nitems >= 4) {
+      long *values = (long *)prop;
+      for (int i = 0; i < 4; i++) {
+        strut[i] = values[i];
+      }
+      XFree(prop);
+      return true;
+    }
+    if (prop) {
+      XFree(prop);
+      prop = NULL;
+    }
+  }
+  return false;
+}
+
+// The top or bottom edge, whichever half of the screen the dock is in
+void edge_strut(Display *dpy, int y, int height, long strut[4]) {
+  int screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+  if (y < screen_height / 2) {
+    strut[STRUT_TOP] = y + height;
+  } else {
+    strut[STRUT_BOTTOM] = screen_height - y;
+  }
+}
+
+// Worker
+// Anything slow to find out about a client (properties nobody needs for
+// tiling, /proc, properties that change after the map) is done on a separate
+// thread with its own connection, so a misbehaving client can't stall the
+// event loop
+static bool work_queue_push(WorkQueue *queue, const ClientDetails *item) {
+  unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (tail - head == WORKER_QUEUE_SIZE) {
+    return false; // Full
+  }
+
+  queue->items[tail % WORKER_QUEUE_SIZE] = *item;
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+static bool work_queue_pop(WorkQueue *queue, ClientDetails *item) {
+  unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head == tail) {
+    return false; // Empty
+  }
+
+  *item = queue->items[head % WORKER_QUEUE_SIZE];
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return true;
+}
+
+static void read_window_text(Display *dpy, Window win, Atom property,
+                             char *dest, size_t size) {
+  XTextProperty text;
+  if (XGetTextProperty(dpy, win, &text, property) && text.value) {
+    snprintf(dest, size, "%s", (char *)text.value);
+    XFree(text.value);
+  }
+}
+
+static void fetch_client_details(Display *dpy, ClientDetails *details) {
+  Window win = details->window;
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char *prop = NULL;
+
+  if (XGetWindowProperty(dpy, win, worker->net_wm_pid, 0, 1, False,
+                         XA_CARDINAL, &actual_type, &actual_format, &nitems,
+                         &bytes_after, &prop) == Success) {
+    if (prop && nitems == 1) {
+      unsigned long pid = *(unsigned long *)prop;
+      details->pid = pid;
+    }
+    if (prop) {
+      XFree(prop);
+    }
+  }
+
+  read_window_text(dpy, win, worker->net_wm_name, details->name,
+                   sizeof(details->name));
+  if (!details->name[0]) {
+    read_window_text(dpy, win, XA_WM_NAME, details->name,
+                     sizeof(details->name));
+  }
+  read_window_text(dpy, win, XA_WM_CLIENT_MACHINE, details->machine,
+                   sizeof(details->machine));
+
+  XClassHint class_hint;
+  if (XGetClassHint(dpy, win, &class_hint)) {
+    snprintf(details->wm_class, sizeof(details->wm_class), "%s",
+             class_hint.res_class ? class_hint.res_class : "");
+    XFree(class_hint.res_name);
+    XFree(class_hint.res_class);
+  }
+
+  // The pid only means something if the client runs on this machine
+  char hostname[HOST_NAME_MAX + 1] = "";
+  gethostname(hostname, sizeof(hostname));
+  if (details->pid > 0 &&
+      (!details->machine[0] || strcmp(details->machine, hostname) == 0)) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/comm", details->pid);
+    FILE *file = fopen(path, "r");
+    if (file) {
+      if (fgets(details->command, sizeof(details->command), file)) {
+        details->command[strcspn(details->command, "\n")] = '\0';
+      }
+      fclose(file);
+    }
+  }
+}
+
+static void fetch_strut(Display *dpy, ClientDetails *details) {
+  if (read_strut(dpy, details->window, worker->net_wm_strut_partial,
+                 worker->net_wm_strut, details->strut)) {
+    return;
+  }
+
+  Window root;
+  int x, y;
+  unsigned int width, height, border_width, depth;
+  if (XGetGeometry(dpy, details->window, &root, &x, &y, &width, &height,
+                   &border_width, &depth)) {
+    edge_strut(dpy, y, height, details->strut);
+  }
+}
+
+void *worker_main(void *arg) {
+  // Its display's worker, which is thread local over there
+  worker = arg;
+  display_index = -1;
+  Display *dpy = worker->dpy;
+  ClientDetails details;
+
+  while (!atomic_load(&worker->stopping)) {
+    drain(worker->requests_fd);
+
+    while (!atomic_load(&worker->stopping) &&
+           work_queue_pop(&worker->requests, &details)) {
+      if (details.fetch == FETCH_SIZE_HINTS) {
+        read_size_hints(dpy, details.window, &details.hints);
+      } else if (details.fetch == FETCH_STRUT) {
+        fetch_strut(dpy, &details);
+      } else {
+        fetch_client_details(dpy, &details);
+      }
+      while (!work_queue_push(&worker->results, &details) &&
+             !atomic_load(&worker->stopping)) {
+        // Main thread is behind, give it a moment
+        usleep(1000);
+      }
+      wake(worker->results_fd);
+    }
+  }
+  return NULL;
+}
+
+void start_worker(Display *dpy) {
+  worker = calloc(1, sizeof(Worker));
+  if (!worker) {
+    errx(1, "Couldn't allocate the worker");
+  }
+  worker->requests_fd = -1;
+  worker->results_fd = -1;
+
+  Display *worker_dpy = XOpenDisplay(DisplayString(dpy));
+  if (!worker_dpy) {
+    fprintf(stderr, "Couldn't open a second connection, no worker\n");
+    return;
+  }
+  worker->net_wm_pid = XInternAtom(worker_dpy, "_NET_WM_PID", False);
+  worker->net_wm_name = XInternAtom(worker_dpy, "_NET_WM_NAME", False);
+  worker->net_wm_strut = XInternAtom(worker_dpy, "_NET_WM_STRUT", False);
+  worker->net_wm_strut_partial =
+      XInternAtom(worker_dpy, "_NET_WM_STRUT_PARTIAL", False);
+  worker->dpy = worker_dpy;
+
+  worker->requests_fd = eventfd(0, EFD_CLOEXEC);
+  worker->results_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+    perror("pthread_create");
+    close(worker->requests_fd);
+    close(worker->results_fd);
+    worker->requests_fd = worker->results_fd = -1;
+    XCloseDisplay(worker_dpy);
+    return;
+  }
+}
+
+// Its connection is left as it is, stop_worker only runs once the server is
+// gone and closing it would only run into the same error
+void stop_worker() {
+  if (worker->requests_fd >= 0) {
+    atomic_store(&worker->stopping, true);
+    wake(worker->requests_fd);
+    pthread_join(worker->thread, NULL);
+    close(worker->requests_fd);
+    close(worker->results_fd);
+  }
+  free(worker);
+  worker = NULL;
+}
+
+void request_from_worker(Window window, int fetch) {
+  if (worker->requests_fd < 0) {
+    return;
+  }
+
+  ClientDetails details = {.window = window, .fetch = fetch};
+  if (!work_queue_push(&worker->requests, &details)) {
+    fprintf(stderr, "Worker queue full, dropped a request for 0x%lx\n",
+            window);
+    return;
+  }
+  wake(worker->requests_fd);
+}
+
+// Status bar
+Dock *find_dock(Window window) {
+  for (int i = 0; i < num_docks; i++) {
+    if (docks[i].window == window) {
+      return &docks[i];
+    }
+  }
+  return NULL;
+}
+
+// With neither strut property a dock reserves the screen edge it sits
+// against
+void read_dock_strut(Display *dpy, Dock *dock) {
+  if (read_strut(dpy, dock->window, net_wm_strut_partial, net_wm_strut,
+                 dock->strut)) {
+    return;
+  }
+
+  int x, y, width, height;
+  get_window_geometry(dpy, dock->window, &x, &y, &width, &height);
+  edge_strut(dpy, y, height, dock->strut);
+}
+
+void publish_work_area(Display *dpy) {
+  long values[MAX_WORKSPACES * 4];
+  for (int i = 0; i < MAX_WORKSPACES; i++) {
+    values[i * 4] = work_area.x;
+    values[i * 4 + 1] = work_area.y;
+    values[i * 4 + 2] = work_area.width;
+    values[i * 4 + 3] = work_area.height;
+  }
+  XChangeProperty(dpy, RootWindow(dpy, DefaultScreen(dpy)), net_workarea,
+                  XA_CARDINAL, 32, PropModeReplace, (unsigned char *)values,
+                  MAX_WORKSPACES * 4);
+}
+
+// Combines every dock's strut into the work area. Returns true if it changed
+bool update_work_area(Display *dpy) {
+  long reserved[4] = {0};
+  for (int i = 0; i < num_docks; i++) {
+    for (int side = 0; side < 4; side++) {
+      reserved[side] = MAX(reserved[side], docks[i].strut[side]);
+    }
+  }
+
+  int screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
+  int screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+  WorkArea area = {
+      .x = reserved[STRUT_LEFT],
+      .y = reserved[STRUT_TOP],
+      .width = MAX(1, screen_width - reserved[STRUT_LEFT] -
+                          reserved[STRUT_RIGHT]),
+      .height = MAX(1, screen_height - reserved[STRUT_TOP] -
+                           reserved[STRUT_BOTTOM]),
+  };
+
+  if (memcmp(&area, &work_area, sizeof(area)) == 0) {
+    return false;
+  }
+  work_area = area;
+  publish_work_area(dpy);
+  printf("Work area is now %dx%d+%d+%d\n", work_area.width, work_area.height,
+         work_area.x, work_area.y);
+  return true;
+}
+
+void add_dock(Display *dpy, Window window) {
+  Dock *dock = find_dock(window);
+  if (!dock) {
+    if (num_docks == MAX_DOCKS) {
+      fprintf(stderr, "Dock limit exceeded\n");
+      return;
+    }
+    dock = &docks[num_docks++];
+    dock->window = window;
+    job_dock_mapped();
+  }
+
+  // Docks can change their strut at any time
+  XSelectInput(dpy, window, StructureNotifyMask | PropertyChangeMask);
+  read_dock_strut(dpy, dock);
+  update_work_area(dpy);
+}
+
+// Window decorations
+void hex_to_rgb(const char *hex, XColor *color, Display *dpy) {
+  unsigned int r, g, b;
+  if (sscanf(hex, "#%02x%02x%02x", &r, &g, &b) != 3) {
+    fprintf(stderr, "Invalid color format: %s\n", hex);
+    return;
+  }
+
+  color->red = r * 257;   // Scale up to 16-bit
+  color->green = g * 257; // Scale up to 16-bit
+  color->blue = b * 257;  // Scale up to 16-bit
+  color->flags = DoRed | DoGreen | DoBlue;
+  XAllocColor(dpy, DefaultColormap(dpy, DefaultScreen(dpy)), color);
+}
+
+void draw_window_border(Display *dpy, Window window, int border_width,
+                        unsigned long pixel) {
+  XSetWindowBorder(dpy, window, pixel);
+  XSetWindowBorderWidth(dpy, window, border_width);
+}
+
+// Runtime configuration
+void load_default_config(Config *cfg) {
+  cfg->inner_gap = INNER_GAP;
+  cfg->outer_gap = OUTER_GAP;
+  cfg->border_width = BORDER_WIDTH;
+  snprintf(cfg->border_color, sizeof(cfg->border_color), "%s", BORDER_COLOR);
+  snprintf(cfg->inactive_border_color, sizeof(cfg->inactive_border_color),
+           "%s", INACTIVE_BORDER_COLOR);
+  cfg->modifier = MODIFIER;
+  cfg->park_hidden_windows = PARK_HIDDEN_WINDOWS;
+  cfg->kill_key = KILL_KEY;
+  cfg->next_window_key = NEXT_WINDOW_KEY;
+  cfg->monocle_key = MONOCLE_KEY;
+  cfg->focus_left_key = FOCUS_LEFT_KEY;
+  cfg->focus_right_key = FOCUS_RIGHT_KEY;
+  cfg->focus_up_key = FOCUS_UP_KEY;
+  cfg->focus_down_key = FOCUS_DOWN_KEY;
+  cfg->default_layout = DEFAULT_LAYOUT;
+  cfg->prev_window_key = PREV_WINDOW_KEY;
+  cfg->mru_window_key = MRU_WINDOW_KEY;
+
+  cfg->num_keybindings = NUM_KEYBINDINGS;
+  cfg->keybindings = malloc(sizeof(keybindings));
+  memcpy(cfg->keybindings, keybindings, sizeof(keybindings));
+  for (int i = 0; i < cfg->num_keybindings; i++) {
+    if (keybindings[i].command) {
+      cfg->keybindings[i].command = strdup(keybindings[i].command);
+    }
+  }
+
+  cfg->num_jobs = NUM_STARTUP_JOBS;
+  cfg->jobs = malloc(sizeof(startup_jobs));
+  for (int i = 0; i < cfg->num_jobs; i++) {
+    cfg->jobs[i] = startup_jobs[i];
+    cfg->jobs[i].name = strdup(startup_jobs[i].name);
+    cfg->jobs[i].command = strdup(startup_jobs[i].command);
+    if (startup_jobs[i].after) {
+      cfg->jobs[i].after = strdup(startup_jobs[i].after);
+    }
+  }
+
+  cfg->num_pools = NUM_POOL_COMMANDS;
+  cfg->pools = malloc(sizeof(pool_commands));
+  for (int i = 0; i < cfg->num_pools; i++) {
+    cfg->pools[i].command = strdup(pool_commands[i].command);
+    cfg->pools[i].size = pool_commands[i].size;
+  }
+
+  cfg->freeze_workspaces = FREEZE_WORKSPACES;
+  cfg->freeze_grace = FREEZE_GRACE;
+  cfg->num_freeze_exempt = NUM_FREEZE_EXEMPT;
+  cfg->freeze_exempt = malloc(sizeof(char *) * NUM_FREEZE_EXEMPT);
+  for (int i = 0; i < cfg->num_freeze_exempt; i++) {
+    cfg->freeze_exempt[i] = strdup(freeze_exempt[i]);
+  }
+}
+
+void free_keybindings(Config *cfg) {
+  for (int i = 0; i < cfg->num_keybindings; i++) {
+    free((char *)cfg->keybindings[i].command);
+  }
+  free(cfg->keybindings);
+  cfg->keybindings = NULL;
+  cfg->num_keybindings = 0;
+}
+
+void free_jobs(Config *cfg) {
+  for (int i = 0; i < cfg->num_jobs; i++) {
+    free((char *)cfg->jobs[i].name);
+    free((char *)cfg->jobs[i].command);
+    free((char *)cfg->jobs[i].after);
+  }
+  free(cfg->jobs);
+  cfg->jobs = NULL;
+  cfg->num_jobs = 0;
+}
+
+void free_pools(Config *cfg) {
+  for (int i = 0; i < cfg->num_pools; i++) {
+    free((char *)cfg->pools[i].command);
+  }
+  free(cfg->pools);
+  cfg->pools = NULL;
+  cfg->num_pools = 0;
+}
+
+void free_freeze_exempt(Config *cfg) {
+  for (int i = 0; i < cfg->num_freeze_exempt; i++) {
+    free(cfg->freeze_exempt[i]);
+  }
+  free(cfg->freeze_exempt);
+  cfg->freeze_exempt = NULL;
+  cfg->num_freeze_exempt = 0;
+}
+
+void free_config(Config *cfg) {
+  free_keybindings(cfg);
+  free_jobs(cfg);
+  free_pools(cfg);
+  free_freeze_exempt(cfg);
+}
+
+void resolve_config_colors(Display *dpy, Config *cfg) {
+  XColor color = {0};
+  hex_to_rgb(cfg->border_color, &color, dpy);
+  cfg->border_pixel = color.pixel;
+
+  memset(&color, 0, sizeof(color));
+  hex_to_rgb(cfg->inactive_border_color, &color, dpy);
+  cfg->inactive_border_pixel = color.pixel;
+  stats.colors_allocated += 2;
+}
+
+void free_config_colors(Display *dpy, Config *cfg) {
+  unsigned long pixels[] = {cfg->border_pixel, cfg->inactive_border_pixel};
+  XFreeColors(dpy, DefaultColormap(dpy, DefaultScreen(dpy)), pixels, 2, 0);
+  stats.colors_freed += 2;
+}
+
+// "mod" in a binding means whatever `modifier` ends up being, which may be
+// set further down the file, so it's resolved after parsing
+#define MOD_PLACEHOLDER (1 << 14)
+
+static char *trim(char *str) {
+  while (*str == ' ' || *str == '\t') {
+    str++;
+  }
+  char *end = str + strlen(str);
+  while (end > str && (end[-1] == ' ' || end[-1] == '\t' ||
+                       end[-1] == '\n' || end[-1] == '\r')) {
+    *--end = '\0';
+  }
+  return str;
+}
+
+static bool parse_modifier(const char *name, unsigned int *mask) {
+  if (strcmp(name, "mod") == 0) {
+    *mask = MOD_PLACEHOLDER;
+  } else if (strcmp(name, "shift") == 0) {
+    *mask = ShiftMask;
+  } else if (strcmp(name, "control") == 0 || strcmp(name, "ctrl") == 0) {
+    *mask = ControlMask;
+  } else if (strcmp(name, "alt") == 0) {
+    *mask = Mod1Mask;
+  } else if (strcmp(name, "super") == 0) {
+    *mask = Mod4Mask;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Parses "mod+shift+Return" into a keysym and modifier mask
+static bool parse_key_combo(char *combo, KeySym *keysym,
+                            unsigned int *modifier) {
+  *modifier = 0;
+  char *part = combo;
+  char *plus;
+  while ((plus = strchr(part, '+')) != NULL && plus[1] != '\0') {
+    *plus = '\0';
+    unsigned int mask;
+    if (!parse_modifier(part, &mask)) {
+      return false;
+    }
+    *modifier |= mask;
+    part = plus + 1;
+  }
+
+  *keysym = XStringToKeysym(part);
+  return *keysym != NoSymbol;
+}
+
+// bind = <combo> exec <command>
+// bind = <combo> workspace <n>
+static bool parse_binding(char *value, Keybinding *binding) {
+  // strtok_r, every display parses the config on its own thread
+  char *saveptr;
+  char *combo = strtok_r(value, " \t", &saveptr);
+  char *action = strtok_r(NULL, " \t", &saveptr);
+  char *args = strtok_r(NULL, "", &saveptr);
+  if (!combo || !action || !args) {
+    return false;
+  }
+  if (!parse_key_combo(combo, &binding->keysym, &binding->modifier)) {
+    return false;
+  }
+
+  args = trim(args);
+  if (strcmp(action, "exec") == 0) {
+    binding->command = strdup(args);
+    binding->workspace = -1;
+  } else if (strcmp(action, "workspace") == 0) {
+    binding->command = NULL;
+    binding->workspace = atoi(args);
+    if (binding->workspace < 0 || binding->workspace >= MAX_WORKSPACES) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// job = <name> [after=<job>,...] [ready=started|exited|dock|window] [restart]
+//       exec <command>
+static bool parse_job(char *value, StartupJob *job) {
+  static const char *ready_names[] = {
+      [READY_STARTED] = "started",
+      [READY_EXITED] = "exited",
+      [READY_DOCK] = "dock",
+      [READY_WINDOW] = "window",
+  };
+
+  char *saveptr;
+  char *name = strtok_r(value, " \t", &saveptr);
+  if (!name) {
+    return false;
+  }
+  *job = (StartupJob){.ready = READY_STARTED};
+
+  char *option;
+  while ((option = strtok_r(NULL, " \t", &saveptr)) && strcmp(option, "exec") != 0) {
+    if (strncmp(option, "after=", 6) == 0) {
+      job->after = option + 6;
+    } else if (strncmp(option, "ready=", 6) == 0) {
+      int ready = -1;
+      for (int i = 0; i < 4; i++) {
+        if (strcmp(option + 6, ready_names[i]) == 0) {
+          ready = i;
+        }
+      }
+      if (ready < 0) {
+        return false;
+      }
+      job->ready = ready;
+    } else if (strcmp(option, "restart") == 0) {
+      job->restart = 1;
+    } else {
+      return false;
+    }
+  }
+
+  char *command = option ? strtok_r(NULL, "", &saveptr) : NULL;
+  if (!command || !*(command = trim(command))) {
+    return false;
+  }
+  job->name = strdup(name);
+  job->command = strdup(command);
+  job->after = job->after ? strdup(job->after) : NULL;
+  return true;
+}
+
+// Only #rrggbb, hex_to_rgb reads it as it is
+static bool parse_color(const char *value, char *dest, size_t size) {
+  if (strlen(value) != 7 || value[0] != '#') {
+    return false;
+  }
+  for (int i = 1; i < 7; i++) {
+    if (!isxdigit((unsigned char)value[i])) {
+      return false;
+    }
+  }
+  snprintf(dest, size, "%s", value);
+  return true;
+}
+
+// Reads the config file on top of the compiled defaults. Returns false if the
+// file couldn't be opened, in which case cfg holds just the defaults
+bool load_config_file(Config *cfg, const char *path) {
+  load_default_config(cfg);
+
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+
+  Keybinding *bindings = NULL;
+  int num_bindings = 0;
+  StartupJob *jobs = NULL;
+  int num_jobs = 0;
+  PoolCommand *pool_lines = NULL;
+  int num_pool_lines = 0;
+  char line[512];
+  int line_number = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    char *str = trim(line);
+    if (*str == '\0' || *str == '#') {
+      continue;
+    }
+
+    char *eq = strchr(str, '=');
+    if (!eq) {
+      fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+      continue;
+    }
+    *eq = '\0';
+    char *key = trim(str);
+    char *value = trim(eq + 1);
+    bool ok = true;
+
+    if (strcmp(key, "inner_gap") == 0) {
+      cfg->inner_gap = atoi(value);
+    } else if (strcmp(key, "outer_gap") == 0) {
+      cfg->outer_gap = atoi(value);
+    } else if (strcmp(key, "border_width") == 0) {
+      cfg->border_width = atoi(value);
+    } else if (strcmp(key, "border_color") == 0) {
+      ok = parse_color(value, cfg->border_color, sizeof(cfg->border_color));
+    } else if (strcmp(key, "inactive_border_color") == 0) {
+      ok = parse_color(value, cfg->inactive_border_color,
+                       sizeof(cfg->inactive_border_color));
+    } else if (strcmp(key, "modifier") == 0) {
+      ok = parse_modifier(value, &cfg->modifier) &&
+           cfg->modifier != MOD_PLACEHOLDER;
+    } else if (strcmp(key, "hide_strategy") == 0) {
+      if (strcmp(value, "park") == 0) {
+        cfg->park_hidden_windows = true;
+      } else if (strcmp(value, "unmap") == 0) {
+        cfg->park_hidden_windows = false;
+      } else {
+        ok = false;
+      }
+    } else if (strcmp(key, "kill_key") == 0) {
+      ok = (cfg->kill_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "next_window_key") == 0) {
+      ok = (cfg->next_window_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "prev_window_key") == 0) {
+      ok = (cfg->prev_window_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "mru_window_key") == 0) {
+      ok = (cfg->mru_window_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "monocle_key") == 0) {
+      ok = (cfg->monocle_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "focus_left_key") == 0) {
+      ok = (cfg->focus_left_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "focus_right_key") == 0) {
+      ok = (cfg->focus_right_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "focus_up_key") == 0) {
+      ok = (cfg->focus_up_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "focus_down_key") == 0) {
+      ok = (cfg->focus_down_key = XStringToKeysym(value)) != NoSymbol;
+    } else if (strcmp(key, "layout") == 0) {
+      if (strcmp(value, "tile") == 0) {
+        cfg->default_layout = LAYOUT_TILE;
+      } else if (strcmp(value, "monocle") == 0) {
+        cfg->default_layout = LAYOUT_MONOCLE;
+      } else {
+        ok = false;
+      }
+    } else if (strcmp(key, "bind") == 0) {
+      Keybinding binding;
+      ok = parse_binding(value, &binding);
+      if (ok) {
+        bindings = realloc(bindings, sizeof(Keybinding) * (num_bindings + 1));
+        bindings[num_bindings++] = binding;
+      }
+    } else if (strcmp(key, "job") == 0) {
+      StartupJob job;
+      ok = parse_job(value, &job);
+      if (ok) {
+        jobs = realloc(jobs, sizeof(StartupJob) * (num_jobs + 1));
+        jobs[num_jobs++] = job;
+      }
+    } else if (strcmp(key, "pool") == 0) {
+      // pool = <size> <command>
+      char *command;
+      long size = strtol(value, &command, 10);
+      command = trim(command);
+      ok = command != value && size >= 0 && size <= MAX_POOL_SIZE && *command;
+      if (ok) {
+        pool_lines =
+            realloc(pool_lines, sizeof(PoolCommand) * (num_pool_lines + 1));
+        pool_lines[num_pool_lines++] =
+            (PoolCommand){.command = strdup(command), .size = size};
+      }
+    } else if (strcmp(key, "freeze") == 0) {
+      // freeze = <workspace> ... | none
+      cfg->freeze_workspaces = 0;
+      if (strcmp(value, "none") != 0) {
+        char *saveptr;
+        for (char *word = strtok_r(value, " \t", &saveptr); word && ok;
+             word = strtok_r(NULL, " \t", &saveptr)) {
+          int workspace = atoi(word);
+          ok = workspace >= 1 && workspace <= MAX_WORKSPACES;
+          cfg->freeze_workspaces |= ok ? 1u << (workspace - 1) : 0;
+        }
+      }
+    } else if (strcmp(key, "freeze_grace") == 0) {
+      ok = (cfg->freeze_grace = atoi(value)) >= 0;
+    } else if (strcmp(key, "freeze_exempt") == 0) {
+      // freeze_exempt = <class> ... | none, replaces the compiled list
+      free_freeze_exempt(cfg);
+      if (strcmp(value, "none") != 0) {
+        char *saveptr;
+        for (char *word = strtok_r(value, " \t", &saveptr); word;
+             word = strtok_r(NULL, " \t", &saveptr)) {
+          cfg->freeze_exempt =
+              realloc(cfg->freeze_exempt,
+                      sizeof(char *) * (cfg->num_freeze_exempt + 1));
+          cfg->freeze_exempt[cfg->num_freeze_exempt++] = strdup(word);
+        }
+      }
+    } else {
+      fprintf(stderr, "%s:%d: unknown setting '%s'\n", path, line_number, key);
+      continue;
+    }
+
+    if (!ok) {
+      fprintf(stderr, "%s:%d: invalid value for '%s'\n", path, line_number,
+              key);
+    }
+  }
+  fclose(file);
+
+  // Any bind line replaces the compiled keybinding table as a whole, same for
+  // job and pool lines
+  if (bindings) {
+    free_keybindings(cfg);
+    cfg->keybindings = bindings;
+    cfg->num_keybindings = num_bindings;
+  }
+  if (jobs) {
+    free_jobs(cfg);
+    cfg->jobs = jobs;
+    cfg->num_jobs = num_jobs;
+  }
+  if (pool_lines) {
+    free_pools(cfg);
+    cfg->pools = pool_lines;
+    cfg->num_pools = num_pool_lines;
+  }
+  for (int i = 0; i < cfg->num_keybindings; i++) {
+    if (cfg->keybindings[i].modifier & MOD_PLACEHOLDER) {
+      cfg->keybindings[i].modifier =
+          (cfg->keybindings[i].modifier & ~MOD_PLACEHOLDER) | cfg->modifier;
+    }
+  }
+
+  return true;
+}
+
+bool keybindings_equal(const Config *a, const Config *b) {
+  if (a->modifier != b->modifier || a->kill_key != b->kill_key ||
+      a->next_window_key != b->next_window_key ||
+      a->prev_window_key != b->prev_window_key ||
+      a->mru_window_key != b->mru_window_key ||
+      a->monocle_key != b->monocle_key ||
+      a->focus_left_key != b->focus_left_key ||
+      a->focus_right_key != b->focus_right_key ||
+      a->focus_up_key != b->focus_up_key ||
+      a->focus_down_key != b->focus_down_key ||
+      a->num_keybindings != b->num_keybindings) {
+    return false;
+  }
+
+  for (int i = 0; i < a->num_keybindings; i++) {
+    const Keybinding *x = &a->keybindings[i];
+    const Keybinding *y = &b->keybindings[i];
+    if (x->keysym != y->keysym || x->modifier != y->modifier ||
+        x->workspace != y->workspace) {
+      return false;
+    }
+    if ((x->command == NULL) != (y->command == NULL) ||
+        (x->command && strcmp(x->command, y->command) != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void init_config_path() {
+  const char *config_home = getenv("XDG_CONFIG_HOME");
+  if (config_home && *config_home) {
+    snprintf(config_path, sizeof(config_path), "%s/%s", config_home,
+             CONFIG_FILE);
+  } else {
+    snprintf(config_path, sizeof(config_path), "%s/.config/%s",
+             getenv("HOME") ? getenv("HOME") : "", CONFIG_FILE);
+  }
+  config_name = strrchr(config_path, '/') + 1;
+}
+
+void config_dir(char *dir, size_t size) {
+  snprintf(dir, size, "%.*s", (int)(config_name - config_path - 1),
+           config_path);
+}
+
+bool watch_config_dir() {
+  char dir[PATH_MAX];
+  config_dir(dir, sizeof(dir));
+  config_dir_watch =
+      inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+  return config_dir_watch >= 0;
+}
+
+// Watch the directory rather than the file itself, since most editors save
+// by writing a new file and renaming it over the old one
+void watch_config_file() {
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    perror("inotify_init1");
+    return;
+  }
+  if (watch_config_dir()) {
+    return;
+  }
+
+  // Not there yet, its parent says when it's made
+  char parent[PATH_MAX];
+  config_dir(parent, sizeof(parent));
+  char *slash = strrchr(parent, '/');
+  if (slash) {
+    *slash = '\0';
+  }
+  if (!slash || inotify_add_watch(inotify_fd, parent,
+                                  IN_CREATE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    printf("Not watching %s for config changes\n", parent);
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+}
+
+// Focus history
+void init_focus_history(FocusHistory *history) {
+  history->head = history->tail = -1;
+  for (int i = 0; i < MAX_WINDOWS; i++) {
+    history->nodes[i].next = i + 1 < MAX_WINDOWS ? i + 1 : -1;
+  }
+  history->free = 0;
+}
+
+static void unlink_focus_node(FocusHistory *history, int node) {
+  FocusNode *n = &history->nodes[node];
+  if (n->prev >= 0) {
+    history->nodes[n->prev].next = n->next;
+  } else {
+    history->head = n->next;
+  }
+  if (n->next >= 0) {
+    history->nodes[n->next].prev = n->prev;
+  } else {
+    history->tail = n->prev;
+  }
+}
+
+static void link_focus_node_first(FocusHistory *history, int node) {
+  FocusNode *n = &history->nodes[node];
+  n->prev = -1;
+  n->next = history->head;
+  if (history->head >= 0) {
+    history->nodes[history->head].prev = node;
+  } else {
+    history->tail = node;
+  }
+  history->head = node;
+}
+
+// Adds a window as the most recently focused one if first is set, otherwise
+// as the least
+int focus_history_add(FocusHistory *history, Window window, bool first) {
+  int node = history->free;
+  if (node < 0) {
+    return -1;
+  }
+  history->free = history->nodes[node].next;
+  history->nodes[node].window = window;
+
+  if (first) {
+    link_focus_node_first(history, node);
+  } else {
+    FocusNode *n = &history->nodes[node];
+    n->next = -1;
+    n->prev = history->tail;
+    if (history->tail >= 0) {
+      history->nodes[history->tail].next = node;
+    } else {
+      history->head = node;
+    }
+    history->tail = node;
+  }
+  return node;
+}
+
+void focus_history_touch(FocusHistory *history, int node) {
+  if (node < 0 || history->head == node) {
+    return;
+  }
+  unlink_focus_node(history, node);
+  link_focus_node_first(history, node);
+}
+
+void focus_history_remove(FocusHistory *history, int node) {
+  if (node < 0) {
+    return;
+  }
+  unlink_focus_node(history, node);
+  history->nodes[node].window = None;
+  history->nodes[node].next = history->free;
+  history->free = node;
+}
+
+// The window focus falls back to, None if the workspace is empty
+Window focus_history_first(FocusHistory *history) {
+  return history->head >= 0 ? history->nodes[history->head].window : None;
+}
+
+// Hiding and showing windows
+// Sends a tile its place, unless the server already has it there. Every
+// configure costs the client a ConfigureNotify and usually a redraw
+void configure_tile(Display *dpy, WindowInfo *info) {
+  // It keeps the whole screen until it leaves fullscreen
+  if (info->is_fullscreen) {
+    return;
+  }
+  if (info->server_width == info->width &&
+      info->server_height == info->height && info->server_x == info->x &&
+      info->server_y == info->y) {
+    stats.tile_configures_skipped++;
+    return;
+  }
+  XMoveResizeWindow(dpy, info->window, info->x, info->y, info->width,
+                    info->height);
+  info->server_x = info->x;
+  info->server_y = info->y;
+  info->server_width = info->width;
+  info->server_height = info->height;
+  stats.tile_configures_sent++;
+}
+
+void hide_window(Display *dpy, WindowInfo *info) {
+  if (info->is_hidden) {
+    return;
+  }
+
+  if (config.park_hidden_windows) {
+    // Far enough left that no part of the window is visible. That x is
+    // never a tile's, so the next configure_tile moves it back
+    int parked_x = -2 * DisplayWidth(dpy, DefaultScreen(dpy));
+    XMoveWindow(dpy, info->window, parked_x, info->y);
+    info->server_x = parked_x;
+    info->server_y = info->y;
+    if (!info->server_width) {
+      info->server_width = info->width;
+      info->server_height = info->height;
+    }
+    info->is_parked = 1;
+    stats.windows_parked++;
+  } else {
+    XUnmapWindow(dpy, info->window);
+    info->expected_unmaps++;
+    stats.windows_unmapped++;
+  }
+
+  info->is_hidden = 1;
+  set_wm_state(dpy, info->window, IconicState);
+  update_net_wm_state(dpy, info);
+}
+
+// Tiled windows are put back in place by the next apply_layout
+void show_window(Display *dpy, WindowInfo *info) {
+  if (!info->is_hidden) {
+    return;
+  }
+
+  if (info->is_parked) {
+    if (info->is_fullscreen) {
+      // Back to the whole screen, not into its tile. Its size isn't a tile's
+      // either, so leaving fullscreen has to configure it
+      XMoveWindow(dpy, info->window, 0, 0);
+      info->server_x = 0;
+      info->server_y = 0;
+      info->server_width = 0;
+    } else if (info->is_floating) {
+      XMoveWindow(dpy, info->window, info->x, info->y);
+      info->server_x = info->x;
+      info->server_y = info->y;
+    }
+    info->is_parked = 0;
+    stats.windows_unparked++;
+  } else {
+    XMapWindow(dpy, info->window);
+    stats.windows_mapped++;
+  }
+
+  info->is_hidden = 0;
+  set_wm_state(dpy, info->window, NormalState);
+  update_net_wm_state(dpy, info);
+}
+
+// Spatial index
+#define DIRECTION_LEFT 0
+#define DIRECTION_RIGHT 1
+#define DIRECTION_UP 2
+#define DIRECTION_DOWN 3
+
+// Where the pointer was last seen, from any event that carries it
+__thread int pointer_x = -1, pointer_y = -1;
+
+static void index_cell_range(SpatialIndex *index, WindowInfo *info, int *col0,
+                             int *row0, int *col1, int *row1) {
+  *col0 = CLAMP(info->x / index->cell_width, 0, INDEX_COLS - 1);
+  *row0 = CLAMP(info->y / index->cell_height, 0, INDEX_ROWS - 1);
+  *col1 = CLAMP((info->x + info->width) / index->cell_width, 0,
+                INDEX_COLS - 1);
+  *row1 = CLAMP((info->y + info->height) / index->cell_height, 0,
+                INDEX_ROWS - 1);
+}
+
+void refresh_spatial_index(Display *dpy, TilingLayout *layout) {
+  SpatialIndex *index = &layout->index;
+  if (!index->dirty) {
+    return;
+  }
+
+  int screen = DefaultScreen(dpy);
+  index->cell_width = MAX(1, (DisplayWidth(dpy, screen) + INDEX_COLS - 1) /
+                                 INDEX_COLS);
+  index->cell_height = MAX(1, (DisplayHeight(dpy, screen) + INDEX_ROWS - 1) /
+                                  INDEX_ROWS);
+  memset(index->cells, 0, sizeof(index->cells));
+
+  for (int i = 0; i < layout->count; i++) {
+    int col0, row0, col1, row1;
+    index_cell_range(index, &layout->windows[i], &col0, &row0, &col1, &row1);
+    for (int row = row0; row <= row1; row++) {
+      for (int col = col0; col <= col1; col++) {
+        index->cells[row][col][i / 64] |= 1ULL << (i % 64);
+      }
+    }
+  }
+  index->dirty = false;
+}
+
+// Hidden windows stay in the index (monocle tabs, parked windows), lookups
+// skip them
+#define FOR_EACH_INDEXED(bits, i)                                             \
+  for (int word_ = 0; word_ < INDEX_WORDS; word_++)                           \
+    for (uint64_t left_ = (bits)[word_]; left_ &&                             \
+                                         ((i) = word_ * 64 +                  \
+                                                __builtin_ctzll(left_),       \
+                                         1);                                  \
+         left_ &= left_ - 1)
+
+static bool contains_point(WindowInfo *info, int x, int y) {
+  return x >= info->x && x < info->x + info->width && y >= info->y &&
+         y < info->y + info->height;
+}
+
+// The shown window at a point. The focused window is raised and fullscreen
+// and floating windows sit above tiles, so those win where windows overlap
+WindowInfo *client_at(Display *dpy, TilingLayout *layout, int x, int y) {
+  if (x < 0 || y < 0) {
+    return NULL;
+  }
+  refresh_spatial_index(dpy, layout);
+  SpatialIndex *index = &layout->index;
+  int col = x / index->cell_width, row = y / index->cell_height;
+  if (col >= INDEX_COLS || row >= INDEX_ROWS) {
+    return NULL;
+  }
+
+  WindowInfo *best = NULL;
+  int best_rank = -1;
+  int i;
+  FOR_EACH_INDEXED(index->cells[row][col], i) {
+    WindowInfo *info = &layout->windows[i];
+    if (info->is_hidden || !contains_point(info, x, y)) {
+      continue;
+    }
+    int rank = info->window == focused_window ? 3
+               : info->is_fullscreen          ? 2
+               : info->is_floating            ? 1
+                                              : 0;
+    if (rank > best_rank) {
+      best = info;
+      best_rank = rank;
+    }
+  }
+  return best;
+}
+
+// The nearest shown window whose center lies in a direction from the center
+// of from, counting sideways distance double so windows in line win
+WindowInfo *client_in_direction(Display *dpy, TilingLayout *layout,
+                                WindowInfo *from, int direction) {
+  refresh_spatial_index(dpy, layout);
+  SpatialIndex *index = &layout->index;
+  int cx = from->x + from->width / 2, cy = from->y + from->height / 2;
+  bool horizontal =
+      direction == DIRECTION_LEFT || direction == DIRECTION_RIGHT;
+  int forward = direction == DIRECTION_RIGHT || direction == DIRECTION_DOWN
+                    ? 1
+                    : -1;
+  int cell_size = horizontal ? index->cell_width : index->cell_height;
+  int lines = horizontal ? INDEX_COLS : INDEX_ROWS;
+  int across = horizontal ? INDEX_ROWS : INDEX_COLS;
+  int line = CLAMP((horizontal ? cx : cy) / cell_size, 0, lines - 1);
+
+  WindowInfo *best = NULL;
+  long best_score = 0;
+
+  // Sweep away from the window a column (or row) of cells at a time, until
+  // nothing further out could beat the best so far
+  for (; line >= 0 && line < lines; line += forward) {
+    int near_edge = forward > 0 ? line * cell_size : (line + 1) * cell_size;
+    long reach = forward * (near_edge - (horizontal ? cx : cy));
+    if (best && reach >= best_score) {
+      break;
+    }
+
+    for (int a = 0; a < across; a++) {
+      uint64_t *bits = horizontal ? index->cells[a][line]
+                                  : index->cells[line][a];
+      int i;
+      FOR_EACH_INDEXED(bits, i) {
+        WindowInfo *info = &layout->windows[i];
+        if (info == from || info->is_hidden) {
+          continue;
+        }
+        int x = info->x + info->width / 2, y = info->y + info->height / 2;
+        long ahead = forward * (horizontal ? x - cx : y - cy);
+        long aside = labs(horizontal ? (long)y - cy : (long)x - cx);
+        if (ahead <= 0) {
+          continue;
+        }
+        long score = ahead + 2 * aside;
+        if (!best || score < best_score) {
+          best = info;
+          best_score = score;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+// How much a floating window at this spot would cover of the other shown
+// floating windows
+static long floating_overlap(TilingLayout *layout, Window window, int x, int y,
+                            int width, int height) {
+  SpatialIndex *index = &layout->index;
+  WindowInfo spot = {.x = x, .y = y, .width = width, .height = height};
+  int col0, row0, col1, row1;
+  index_cell_range(index, &spot, &col0, &row0, &col1, &row1);
+  uint64_t near[INDEX_WORDS] = {0};
+  for (int row = row0; row <= row1; row++) {
+    for (int col = col0; col <= col1; col++) {
+      for (int w = 0; w < INDEX_WORDS; w++) {
+        near[w] |= index->cells[row][col][w];
+      }
+    }
+  }
+
+  long overlap = 0;
+  int i;
+  FOR_EACH_INDEXED(near, i) {
+    WindowInfo *info = &layout->windows[i];
+    if (!info->is_floating || info->is_hidden || info->window == window) {
+      continue;
+    }
+    long w = MIN(x + width, info->x + info->width) - MAX(x, info->x);
+    long h = MIN(y + height, info->y + info->height) - MAX(y, info->y);
+    if (w > 0 && h > 0) {
+      overlap += w * h;
+    }
+  }
+  return overlap;
+}
+
+// Where a floating window of this size overlaps the other floating windows
+// the least, nearest the middle of the work area among equals
+void place_floating(Display *dpy, TilingLayout *layout, Window window,
+                    int width, int height, int *x, int *y) {
+  refresh_spatial_index(dpy, layout);
+  *x = work_area.x + (work_area.width - width) / 2;
+  *y = work_area.y + (work_area.height - height) / 2;
+  long best_overlap = floating_overlap(layout, window, *x, *y, width, height);
+  if (best_overlap == 0) {
+    return;
+  }
+
+  // Otherwise every cell corner the window fits from
+  int center_x = *x, center_y = *y;
+  long best_distance = 0;
+  for (int py = work_area.y; py + height <= work_area.y + work_area.height;
+       py += layout->index.cell_height) {
+    for (int px = work_area.x; px + width <= work_area.x + work_area.width;
+         px += layout->index.cell_width) {
+      long overlap = floating_overlap(layout, window, px, py, width, height);
+      long distance = labs((long)px - center_x) + labs((long)py - center_y);
+      if (overlap < best_overlap ||
+          (overlap == best_overlap && distance < best_distance)) {
+        best_overlap = overlap;
+        best_distance = distance;
+        *x = px;
+        *y = py;
+      }
+    }
+  }
+}
+
+// Monocle
+// Only one tile of a monocle workspace is shown, the others are hidden the
+// same way windows of other workspaces are. Focusing another tile swaps the
+// two, so it costs one map and one unmap however many windows there are
+
+// A tile a monocle workspace keeps hidden
+bool is_monocle_tab(TilingLayout *layout, int index) {
+  return layout->mode == LAYOUT_MONOCLE &&
+         !layout->windows[index].is_floating &&
+         index != layout->monocle_index;
+}
+
+// Shows the tile at index in place of the one shown now
+void show_monocle_tile(Display *dpy, TilingLayout *layout, int index) {
+  if (index == layout->monocle_index) {
+    return;
+  }
+
+  // Sized while it's still hidden so it's only drawn once, and shown before
+  // the other one goes so the root never flashes through
+  WindowInfo *info = &layout->windows[index];
+  configure_tile(dpy, info);
+  show_window(dpy, info);
+  if (layout->monocle_index >= 0) {
+    hide_window(dpy, &layout->windows[layout->monocle_index]);
+  }
+  layout->monocle_index = index;
+}
+
+// A monocle workspace shows a tile for as long as it has any
+void ensure_monocle_tile(Display *dpy, TilingLayout *layout) {
+  if (layout->mode != LAYOUT_MONOCLE || layout->monocle_index >= 0) {
+    return;
+  }
+  for (int i = 0; i < layout->count; i++) {
+    if (!layout->windows[i].is_floating) {
+      show_monocle_tile(dpy, layout, i);
+      return;
+    }
+  }
+}
+
+// Event batches (see handle_events). Tiling again and mapping new windows
+// wait for the end of the batch, so a map storm or a burst of strut changes
+// costs one layout pass
+__thread bool in_batch = false;
+__thread bool relayout_due = false;
+__thread Window maps_due[EVENT_BATCH_SIZE];
+__thread int num_maps_due = 0;
+
+bool is_map_due(Window window) {
+  for (int i = 0; i < num_maps_due; i++) {
+    if (maps_due[i] == window) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Focus window
+// mod+tab walks down the current workspace's history without reordering it,
+// so repeated presses go further back. The window it stops on only becomes
+// the most recent one when the cycle ends
+__thread int mru_cycle_node = -1;
+__thread long long mru_cycle_last_press = 0;
+
+void end_focus_cycle() {
+  if (mru_cycle_node < 0) {
+    return;
+  }
+  focus_history_touch(
+      &workspace_manager->layouts[workspace_manager->current_workspace].history,
+      mru_cycle_node);
+  mru_cycle_node = -1;
+}
+
+// Stacking and borders of the focused window. Doesn't need it mapped, so
+// new windows get it before they're shown
+static void draw_focus(Display *dpy, TilingLayout *current_workspace,
+                       WindowInfo *info) {
+  Window window = info->window;
+  if (current_workspace->mode == LAYOUT_MONOCLE && !info->is_floating) {
+    show_monocle_tile(dpy, current_workspace,
+                      info - current_workspace->windows);
+  }
+
+  // Only the window losing focus needs its border redrawn
+  if (focused_window != None && focused_window != window) {
+    draw_window_border(dpy, focused_window, config.border_width,
+                       config.inactive_border_pixel);
+  }
+
+  XRaiseWindow(dpy, window);
+  draw_window_border(dpy, window, config.border_width, config.border_pixel);
+}
+
+// Input focus can only go to a mapped window
+static void give_input_focus(Display *dpy, TilingLayout *current_workspace,
+                             WindowInfo *info) {
+  Window window = info->window;
+  XSetInputFocus(dpy, window, RevertToPointerRoot, CurrentTime);
+  set_active_window(dpy, RootWindow(dpy, DefaultScreen(dpy)), window);
+  focused_window = window;
+  current_workspace->focus_index = info - current_workspace->windows;
+
+  printf("Window 0x%lx focused\n", window);
+}
+
+// Input focus, stacking and borders, leaves the history alone. Windows
+// waiting to be mapped get focus at the end of the event batch instead
+static void set_focus(Display *dpy, TilingLayout *current_workspace,
+                      WindowInfo *info) {
+  if (is_map_due(info->window)) {
+    return;
+  }
+  draw_focus(dpy, current_workspace, info);
+  give_input_focus(dpy, current_workspace, info);
+}
+
+void focus_client(Display *dpy, TilingLayout *current_workspace,
+                  WindowInfo *info) {
+  // Raising the window the cycle is on can send the pointer into it, that
+  // doesn't end the cycle
+  if (mru_cycle_node >= 0 &&
+      current_workspace->history.nodes[mru_cycle_node].window ==
+          info->window) {
+    set_focus(dpy, current_workspace, info);
+    return;
+  }
+
+  end_focus_cycle();
+  set_focus(dpy, current_workspace, info);
+  focus_history_touch(&current_workspace->history, info->focus_node);
+}
+
+void focus_window(Display *dpy, Window window) {
+  TilingLayout *current_workspace =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+
+  // Only managed windows get focus (docks are never in a layout)
+  WindowInfo *info = find_window_info(current_workspace, window);
+  if (!info) {
+    return;
+  }
+  focus_client(dpy, current_workspace, info);
+}
+
+// Focuses whatever was focused before the current window, or before that on
+// the next press within MRU_CYCLE_TIMEOUT, and so on
+void focus_mru_window(Display *dpy) {
+  TilingLayout *current_workspace =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  FocusHistory *history = &current_workspace->history;
+
+  long long now = now_ns();
+  if (mru_cycle_node < 0 ||
+      now - mru_cycle_last_press > MRU_CYCLE_TIMEOUT * 1000000LL) {
+    end_focus_cycle();
+    mru_cycle_node = history->head;
+  }
+  mru_cycle_last_press = now;
+  if (mru_cycle_node < 0) {
+    return;
+  }
+
+  int next = history->nodes[mru_cycle_node].next;
+  mru_cycle_node = next >= 0 ? next : history->head;
+  WindowInfo *info = find_window_info(current_workspace,
+                                      history->nodes[mru_cycle_node].window);
+  if (info) {
+    set_focus(dpy, current_workspace, info);
+  }
+}
+
+// Where the focused window is in the layout. Only searches if focus moved
+// without moody knowing where to
+static int focused_index(TilingLayout *layout) {
+  int index = layout->focus_index;
+  if (index >= 0 && index < layout->count &&
+      layout->windows[index].window == focused_window) {
+    return index;
+  }
+  for (int i = 0; i < layout->count; i++) {
+    if (layout->windows[i].window == focused_window) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void focus_next_window(Display *dpy) {
+  TilingLayout *current_layout =
+      &workspace_manager
+           ->layouts[workspace_manager->current_workspace]; // get the current
+                                                           // workspace layout
+                                                           // struct
+  if (current_layout->count == 0)
+    return; // No windows
+
+  int index = focused_index(current_layout);
+  if (index == -1) {
+    // Focused window not found in the list, default to the first window
+    index = 0;
+  } else {
+    // Focus the next window in the list
+    index = (index + 1) % current_layout->count;
+  }
+
+  focus_client(dpy, current_layout, &current_layout->windows[index]);
+}
+
+void focus_prev_window(Display *dpy) {
+  TilingLayout *current_layout =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  if (current_layout->count == 0)
+    return; // No windows to focus on
+
+  int index = focused_index(current_layout);
+  if (index == -1) {
+    // Focused window not found in the list, default to the last window
+    index = current_layout->count - 1;
+  } else {
+    // Focus the previous window in the list
+    index = (index - 1 + current_layout->count) % current_layout->count;
+  }
+
+  focus_client(dpy, current_layout, &current_layout->windows[index]);
+}
+
+// mod+arrows
+void focus_direction(Display *dpy, int direction) {
+  TilingLayout *current_layout =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  int index = focused_index(current_layout);
+  if (index == -1) {
+    return;
+  }
+
+  WindowInfo *next = client_in_direction(
+      dpy, current_layout, &current_layout->windows[index], direction);
+  if (next) {
+    focus_client(dpy, current_layout, next);
+  }
+}
+
+// Tiling functions
+void init_layout() {
+  layout.count = 0;
+  layout.master = None;
+}
+
+// Reads _NET_WM_WINDOW_TYPE once for both the dock and the floating check,
+// the transient hint is only fetched if the type didn't settle it
+void classify_window(Display *dpy, Window win, bool *is_dock,
+                     bool *is_floating) {
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  Atom *props = NULL;
+
+  *is_dock = false;
+  *is_floating = false;
 
   if (XGetWindowProperty(dpy, win, net_wm_window_type, 0, (~0L), False, XA_ATOM,
                          &actual_type, &actual_format, &nitems, &bytes_after,
                          (unsigned char **)&props) == Success) {
     if (actual_type == XA_ATOM && actual_format == 32) {
       for (unsigned long i = 0; i < nitems; i++) {
+        if (props[i] == net_wm_window_type_dock) {
+          *is_dock = true;
+          break;
+        }
         if (props[i] == net_wm_window_type_dialog ||
             props[i] == net_wm_window_type_utility ||
             props[i] == net_wm_window_type_toolbar ||
@@ -332,7 +3107,7 @@ bool is_floating_window(Display *dpy, Window win) {
             props[i] == net_wm_window_type_popup_menu ||
             props[i] == net_wm_window_type_tooltip ||
             props[i] == net_wm_window_type_notification) {
-          result = true;
+          *is_floating = true;
           break;
         }
       }
@@ -343,38 +3118,117 @@ bool is_floating_window(Display *dpy, Window win) {
   }
 
   // Check for transient windows (usually dialogs)
-  if (!result) {
+  if (!*is_dock && !*is_floating) {
     Window transient_for = None;
     if (XGetTransientForHint(dpy, win, &transient_for) &&
         transient_for != None) {
-      result = true;
+      *is_floating = true;
     }
   }
+}
 
-  return result;
+// In a MapRequest, where waiting on the server is fine. Anything that maps
+// the window later (a pool hit is a key press) goes by what was read here
+void read_window_properties(Display *dpy, Window window,
+                            WindowProperties *props) {
+  classify_window(dpy, window, &props->is_dock, &props->is_floating);
+  get_window_geometry(dpy, window, &props->x, &props->y, &props->width,
+                      &props->height);
+  if (props->is_dock) {
+    memset(&props->hints, 0, sizeof(SizeHints));
+  } else {
+    read_size_hints(dpy, window, &props->hints);
+  }
 }
 
-void manage_floating_window(Display *dpy, Window window) {
-  XWindowAttributes attr;
-  XGetWindowAttributes(dpy, window, &attr);
+// Adjusts a size to the client's WM_NORMAL_HINTS (ICCCM 4.1.2.3)
+void constrain_to_size_hints(WindowInfo *info, int *width, int *height) {
+  SizeHints *hints = &info->hints;
+  int w = *width, h = *height;
+
+  // Base size only counts for aspect ratio when it isn't the minimum too
+  bool base_is_min = hints->base_width == hints->min_width &&
+                     hints->base_height == hints->min_height;
+  if (!base_is_min) {
+    w -= hints->base_width;
+    h -= hints->base_height;
+  }
 
-  // Center the window on the screen
-  int screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
-  int screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+  if (hints->min_aspect > 0 && hints->max_aspect > 0 && w > 0 && h > 0) {
+    if (hints->max_aspect < (float)w / h) {
+      w = h * hints->max_aspect + 0.5;
+    } else if (hints->min_aspect < (float)h / w) {
+      h = w * hints->min_aspect + 0.5;
+    }
+  }
+
+  if (base_is_min) {
+    w -= hints->base_width;
+    h -= hints->base_height;
+  }
+
+  if (hints->inc_width) {
+    w -= w % hints->inc_width;
+  }
+  if (hints->inc_height) {
+    h -= h % hints->inc_height;
+  }
+
+  w = MAX(w + hints->base_width, hints->min_width);
+  h = MAX(h + hints->base_height, hints->min_height);
+  if (hints->max_width) {
+    w = MIN(w, hints->max_width);
+  }
+  if (hints->max_height) {
+    h = MIN(h, hints->max_height);
+  }
+
+  *width = MAX(1, w);
+  *height = MAX(1, h);
+}
 
-  int x = (screen_width - attr.width) / 2;
-  int y = (screen_height - attr.height) / 2;
+// Tiles still never leave their cell, a client whose minimum size doesn't
+// fit just gets the whole cell
+void fit_to_cell(WindowInfo *info) {
+  int width = info->width, height = info->height;
+  constrain_to_size_hints(info, &width, &height);
+  info->width = MIN(width, info->width);
+  info->height = MIN(height, info->height);
+}
 
-  // Ensure the window is not larger than the screen
-  int width = (attr.width > screen_width) ? screen_width : attr.width;
-  int height = (attr.height > screen_height) ? screen_height : attr.height;
+void manage_floating_window(Display *dpy, Window window) {
+  int current_x, current_y, current_width, current_height;
+  get_window_geometry(dpy, window, &current_x, &current_y, &current_width,
+                      &current_height);
+
+  // Ensure the window is not larger than the work area
+  int width =
+      (current_width > work_area.width) ? work_area.width : current_width;
+  int height =
+      (current_height > work_area.height) ? work_area.height : current_height;
+
+  // Centered, unless that covers other floating windows and there's a spot
+  // that covers less
+  TilingLayout *current_layout =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  int x, y;
+  place_floating(dpy, current_layout, window, width, height, &x, &y);
 
   XMoveResizeWindow(dpy, window, x, y, width, height);
 
-  XRaiseWindow(dpy, window);
+  // Remember where it went so it can be put back after being parked
+  WindowInfo *info = find_window_info(current_layout, window);
+  if (info) {
+    info->x = x;
+    info->y = y;
+    info->width = width;
+    info->height = height;
+    current_layout->index.dirty = true;
+  }
 }
 
-void add_window_to_layout(Display *dpy, Window window, TilingLayout *layout) {
+void add_window_to_layout(Display *dpy, Window window, TilingLayout *layout,
+                          const WindowProperties *props) {
   if (layout->count >= MAX_WINDOWS) {
     fprintf(stderr, "Window limit exceeded\n");
     return;
@@ -387,35 +3241,80 @@ void add_window_to_layout(Display *dpy, Window window, TilingLayout *layout) {
     }
   }
 
-  bool is_floating = is_floating_window(dpy, window);
+  bool is_dock = props->is_dock, is_floating = props->is_floating;
 
   // Add window to layout
+  WindowInfo *info = &layout->windows[layout->count];
+  info->x = props->x;
+  info->y = props->y;
+  info->width = props->width;
+  info->height = props->height;
   layout->windows[layout->count].window = window;
-  layout->windows[layout->count].border_width = BORDER_WIDTH;
+  layout->windows[layout->count].configure_period_start = 0;
+  layout->windows[layout->count].configure_period_count = 0;
+  layout->windows[layout->count].border_width = config.border_width;
   layout->windows[layout->count].is_floating = is_floating;
-  if (is_dock_window(dpy, window)) {
-    draw_window_border(dpy, window, 0, BORDER_COLOR);
-    update_dock_geometry(dpy, window);
+  layout->windows[layout->count].is_fullscreen = 0;
+  layout->windows[layout->count].is_hidden = 0;
+  layout->windows[layout->count].is_parked = 0;
+  layout->windows[layout->count].expected_unmaps = 0;
+  layout->windows[layout->count].hidden_cpu_ticks = -1;
+  layout->windows[layout->count].hidden_group_ticks = -1;
+  layout->windows[layout->count].activity = (ClientActivity){0};
+  layout->windows[layout->count].server_x = info->x;
+  layout->windows[layout->count].server_y = info->y;
+  layout->windows[layout->count].server_width = info->width;
+  layout->windows[layout->count].server_height = info->height;
+  layout->windows[layout->count].skip_configure = 0;
+  layout->windows[layout->count].has_details = 0;
+  memset(&layout->windows[layout->count].details, 0, sizeof(ClientDetails));
+  if (is_dock) {
+    draw_window_border(dpy, window, 0, config.border_pixel);
+    add_dock(dpy, window);
 
     return;
   } else {
-    draw_window_border(dpy, window, BORDER_WIDTH, BORDER_COLOR);
+    // It only looks focused once it is
+    draw_window_border(dpy, window, config.border_width,
+                       config.inactive_border_pixel);
   }
+  info->hints = props->hints;
+  info->focus_node = focus_history_add(&layout->history, window, false);
   layout->count++;
+  layout->index.dirty = true;
 
   if (layout->master == None) {
     layout->master = window;
   }
 
+  // Name, class and process are looked up in the background
+  request_from_worker(window, FETCH_DETAILS);
+
   printf("Window 0x%lx added. Total windows: %d\n", window, layout->count);
 }
 
 void remove_window_from_layout(Window window, TilingLayout *layout,
                                Display *dpy) {
+  bool is_current =
+      layout == &workspace_manager->layouts[workspace_manager->current_workspace];
   int found = 0;
   for (int i = 0; i < layout->count; i++) {
     if (layout->windows[i].window == window) {
       found = 1;
+      // Indices past it move down with the windows
+      int *indices[] = {&layout->focus_index, &layout->monocle_index};
+      for (int j = 0; j < 2; j++) {
+        if (*indices[j] == i) {
+          *indices[j] = -1;
+        } else if (*indices[j] > i) {
+          (*indices[j])--;
+        }
+      }
+      int node = layout->windows[i].focus_node;
+      if (is_current && node == mru_cycle_node) {
+        mru_cycle_node = -1;
+      }
+      focus_history_remove(&layout->history, node);
     }
     if (found && i < layout->count - 1) {
       layout->windows[i] = layout->windows[i + 1];
@@ -423,22 +3322,35 @@ void remove_window_from_layout(Window window, TilingLayout *layout,
   }
   if (found) {
     layout->count--;
+    layout->index.dirty = true;
     if (layout->master == window) {
       layout->master = (layout->count > 0) ? layout->windows[0].window : None;
     }
     printf("Window 0x%lx removed. Total windows: %d\n", window, layout->count);
-  }
-  if (layout->count > 0) {
-    focus_next_window(dpy);
+
+    // Focus goes back to whatever had it before
+    if (focused_window == window) {
+      focused_window = None;
+      Window previous = focus_history_first(&layout->history);
+      if (is_current && previous != None) {
+        focus_window(dpy, previous);
+      }
+    }
+    if (is_current) {
+      ensure_monocle_tile(dpy, layout);
+    }
   }
 }
 
-void arrange_window(Display *dpy, int screen_width, int screen_height) {
+void arrange_window(Display *dpy) {
   TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
+      &workspace_manager->layouts[workspace_manager->current_workspace];
   if (current_layout->count == 0)
     return; // No windows to arrange
+  current_layout->index.dirty = true;
 
+  int inner_gap = config.inner_gap;
+  int outer_gap = config.outer_gap;
   int tiling_count = 0;
 
   // Count only non-floating windows
@@ -452,29 +3364,47 @@ void arrange_window(Display *dpy, int screen_width, int screen_height) {
   if (tiling_count == 0)
     return;
 
+  if (current_layout->mode == LAYOUT_MONOCLE) {
+    // Every tile gets the whole work area, only one is ever shown
+    for (int i = 0; i < current_layout->count; i++) {
+      WindowInfo *info = &current_layout->windows[i];
+      if (!info->is_floating) {
+        info->x = work_area.x;
+        info->y = work_area.y;
+        info->width = work_area.width - 2 * config.border_width;
+        info->height = work_area.height - 2 * config.border_width;
+        fit_to_cell(info);
+      }
+    }
+    return;
+  }
+
   // Calculate the usable area considering the gaps
-  int usable_width = screen_width - 2 * OUTER_GAP;
-  int usable_height = screen_height - 2 * OUTER_GAP - dock_geometry.height;
+  int usable_width = work_area.width - 2 * outer_gap;
+  int usable_height = work_area.height - 2 * outer_gap;
+  int left = work_area.x + outer_gap;
+  int top = work_area.y + outer_gap;
 
   if (tiling_count == 1) {
     // Only one non-floating window, make it full screen with gaps
     for (int i = 0; i < current_layout->count; i++) {
       if (!current_layout->windows[i].is_floating) {
-        current_layout->windows[i].x = OUTER_GAP;
-        current_layout->windows[i].y = OUTER_GAP;
+        current_layout->windows[i].x = left;
+        current_layout->windows[i].y = top;
         current_layout->windows[i].width = usable_width;
         current_layout->windows[i].height = usable_height;
+        fit_to_cell(&current_layout->windows[i]);
         break;
       }
     }
   } else {
     // More than one window, apply tiling layout
-    int master_width = (usable_width / 2) * 1.2 - (INNER_GAP / 2);
-    int stack_width = (usable_width - master_width) - INNER_GAP;
+    int master_width = (usable_width / 2) * 1.2 - (inner_gap / 2);
+    int stack_width = (usable_width - master_width) - inner_gap;
 
     // Avoid division by zero
     int stack_height =
-        (usable_height - INNER_GAP * (tiling_count - 2)) / (tiling_count - 1);
+        (usable_height - inner_gap * (tiling_count - 2)) / (tiling_count - 1);
     if (tiling_count == 2) {
       stack_height = usable_height; // Special case for two windows
     }
@@ -483,17 +3413,18 @@ void arrange_window(Display *dpy, int screen_width, int screen_height) {
     for (int i = 0; i < current_layout->count; i++) {
       if (!current_layout->windows[i].is_floating) {
         if (tiling_index == 0) {
-          current_layout->windows[i].x = OUTER_GAP;
-          current_layout->windows[i].y = OUTER_GAP;
+          current_layout->windows[i].x = left;
+          current_layout->windows[i].y = top;
           current_layout->windows[i].width = master_width;
           current_layout->windows[i].height = usable_height;
         } else {
-          current_layout->windows[i].x = OUTER_GAP + master_width + INNER_GAP;
+          current_layout->windows[i].x = left + master_width + inner_gap;
           current_layout->windows[i].y =
-              OUTER_GAP + (stack_height + INNER_GAP) * (tiling_index - 1);
+              top + (stack_height + inner_gap) * (tiling_index - 1);
           current_layout->windows[i].width = stack_width;
           current_layout->windows[i].height = stack_height;
         }
+        fit_to_cell(&current_layout->windows[i]);
         tiling_index++;
       }
     }
@@ -502,23 +3433,84 @@ void arrange_window(Display *dpy, int screen_width, int screen_height) {
 
 void apply_layout(Display *dpy) {
   TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+
+  // Hidden tiles of a monocle workspace are sized when they're shown
+  if (current_layout->mode == LAYOUT_MONOCLE) {
+    if (current_layout->monocle_index >= 0) {
+      configure_tile(dpy,
+                     &current_layout->windows[current_layout->monocle_index]);
+    }
+    return;
+  }
+
   for (int i = 0; i < current_layout->count; i++) {
     if (!current_layout->windows[i].is_floating) {
-      XMoveResizeWindow(
-          dpy, current_layout->windows[i].window, current_layout->windows[i].x,
-          current_layout->windows[i].y, current_layout->windows[i].width,
-          current_layout->windows[i].height);
+      configure_tile(dpy, &current_layout->windows[i]);
+    }
+  }
+}
+
+// Tiles the current workspace again, at the end of the batch if in one
+void relayout(Display *dpy) {
+  if (in_batch) {
+    relayout_due = true;
+    return;
+  }
+  arrange_window(dpy);
+  apply_layout(dpy);
+}
+
+// mod+m, flips the current workspace between tiling and monocle
+void toggle_monocle(Display *dpy) {
+  TilingLayout *current_layout =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+
+  if (current_layout->mode == LAYOUT_MONOCLE) {
+    current_layout->mode = LAYOUT_TILE;
+    current_layout->monocle_index = -1;
+    for (int i = 0; i < current_layout->count; i++) {
+      show_window(dpy, &current_layout->windows[i]);
+    }
+  } else {
+    // Keep the focused tile, or any tile if a floating window has focus
+    int shown = focused_index(current_layout);
+    if (shown >= 0 && current_layout->windows[shown].is_floating) {
+      shown = -1;
+    }
+    current_layout->mode = LAYOUT_MONOCLE;
+    current_layout->monocle_index = shown;
+    for (int i = 0; i < current_layout->count; i++) {
+      if (i != shown && !current_layout->windows[i].is_floating) {
+        hide_window(dpy, &current_layout->windows[i]);
+      }
     }
   }
+
+  arrange_window(dpy);
+  apply_layout(dpy);
+  ensure_monocle_tile(dpy, current_layout);
+
+  printf("Workspace %d is now %s\n", workspace_manager->current_workspace,
+         current_layout->mode == LAYOUT_MONOCLE ? "monocle" : "tiled");
 }
 
 // Workspace functions
 void init_workspace_manager() {
-  workspace_manager.current_workspace = 0;
+  workspace_manager = calloc(1, sizeof(WorkspaceManager));
+  if (!workspace_manager) {
+    errx(1, "Couldn't allocate the workspaces");
+  }
+  workspace_manager->current_workspace = 0;
   for (int i = 0; i < MAX_WORKSPACES; i++) {
-    workspace_manager.layouts[i].count = 0;
-    workspace_manager.layouts[i].master = None;
+    workspace_manager->layouts[i].count = 0;
+    workspace_manager->layouts[i].master = None;
+    init_focus_history(&workspace_manager->layouts[i].history);
+    workspace_manager->layouts[i].mode = config.default_layout;
+    workspace_manager->layouts[i].focus_index = -1;
+    workspace_manager->layouts[i].monocle_index = -1;
+    workspace_manager->layouts[i].index.dirty = true;
+    workspace_manager->layouts[i].hidden_since = i == 0 ? 0 : now_ns();
   }
 }
 
@@ -527,42 +3519,50 @@ void move_window_to_workspace(Display *dpy, int target_workspace) {
     return;
 
   TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
-  Window focused_window;
-  int revert_to;
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  TilingLayout *target_layout = &workspace_manager->layouts[target_workspace];
 
   // Current workspace
-  if (target_workspace == workspace_manager.current_workspace) {
+  if (target_workspace == workspace_manager->current_workspace) {
     return;
   }
 
-  // Get the currently focused window
-  XGetInputFocus(dpy, &focused_window, &revert_to);
-
-  if (focused_window == None || focused_window == PointerRoot) {
+  WindowInfo *info = find_window_info(current_layout, focused_window);
+  if (!info) {
     printf("No window is focused\n");
     return;
   }
+  if (target_layout->count >= MAX_WINDOWS) {
+    fprintf(stderr, "Window limit exceeded\n");
+    return;
+  }
 
-  // Remove window from current workspace
-  remove_window_from_layout(focused_window, current_layout, dpy);
-  XUnmapWindow(dpy, focused_window);
-
-  // Add window to the target workspace
-  TilingLayout *target_layout = &workspace_manager.layouts[target_workspace];
-  add_window_to_layout(dpy, focused_window, target_layout);
-
-  // Set the window state to withdrawn to ensure it is managed correctly in the
-  // new workspace
-  XEvent ev;
-  ev.type = UnmapNotify;
-  ev.xunmap.window = focused_window;
-  XSendEvent(dpy, focused_window, False, StructureNotifyMask, &ev);
+  // Carry the window's state over instead of asking the server again
+  WindowInfo moved = *info;
+  draw_window_border(dpy, moved.window, config.border_width,
+                     config.inactive_border_pixel);
+  remove_window_from_layout(moved.window, current_layout, dpy);
+
+  // Add window to the target workspace and hide it there
+  // It was focused last, so it gets focus back when that workspace is shown
+  moved.focus_node =
+      focus_history_add(&target_layout->history, moved.window, true);
+  target_layout->windows[target_layout->count] = moved;
+  hide_window(dpy, &target_layout->windows[target_layout->count]);
+  target_layout->count++;
+  target_layout->index.dirty = true;
+  if (target_layout->master == None) {
+    target_layout->master = moved.window;
+  }
+  set_window_desktop(dpy, moved.window, target_workspace);
+  restart_freeze_grace(target_layout);
 
+  arrange_window(dpy);
+  apply_layout(dpy);
   update_client_list(dpy, RootWindow(dpy, DefaultScreen(dpy)),
-                     target_layout->windows, target_layout->count);
+                     current_layout->windows, current_layout->count);
 
-  printf("Moved window 0x%lx to workspace %d\n", focused_window,
+  printf("Moved window 0x%lx to workspace %d\n", moved.window,
          target_workspace);
 }
 
@@ -570,30 +3570,50 @@ void switch_workspace(Display *dpy, int workspace_index) {
   if (workspace_index > MAX_WORKSPACES)
     return;
 
-  if (workspace_manager.current_workspace == workspace_index) {
+  if (workspace_manager->current_workspace == workspace_index) {
     printf("Already on workspace %d\n", workspace_index);
     return;
   }
 
-  TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
-  TilingLayout *new_layout = &workspace_manager.layouts[workspace_index];
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-  // Hide windows in current workspace
+  TilingLayout *current_layout =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  TilingLayout *new_layout = &workspace_manager->layouts[workspace_index];
+
+  // Hide windows in current workspace, none of them is focused there anymore
+  end_focus_cycle();
+  if (focused_window != None) {
+    draw_window_border(dpy, focused_window, config.border_width,
+                       config.inactive_border_pixel);
+  }
   for (int i = 0; i < current_layout->count; i++) {
-    XUnmapWindow(dpy, current_layout->windows[i].window);
+    hide_window(dpy, &current_layout->windows[i]);
   }
+  restart_freeze_grace(current_layout);
+
+  // Stopped clients get going again before their windows are mapped
+  thaw_workspace(new_layout);
+  new_layout->hidden_since = 0;
 
   // Change to new workspace
-  workspace_manager.current_workspace = workspace_index;
+  workspace_manager->current_workspace = workspace_index;
+  focused_window = None;
 
-  // Show windows in new workspace
+  // Show windows in new workspace, on a monocle one just a single tile
+  ensure_monocle_tile(dpy, new_layout);
   for (int i = 0; i < new_layout->count; i++) {
-    XMapWindow(dpy, new_layout->windows[i].window);
+    if (is_monocle_tab(new_layout, i)) {
+      continue;
+    }
+    show_window(dpy, &new_layout->windows[i]);
   }
 
   for (int i = new_layout->count - 1; i >= 0; i--) {
-    XRaiseWindow(dpy, new_layout->windows[i].window);
+    if (!is_monocle_tab(new_layout, i)) {
+      XRaiseWindow(dpy, new_layout->windows[i].window);
+    }
   }
 
   // Update ewmh properties
@@ -603,66 +3623,388 @@ void switch_workspace(Display *dpy, int workspace_index) {
                      new_layout->windows, new_layout->count);
 
   // Reapply layout for the new workspace
-  arrange_window(dpy, DisplayWidth(dpy, DefaultScreen(dpy)),
-                 DisplayHeight(dpy, DefaultScreen(dpy)));
+  arrange_window(dpy);
   apply_layout(dpy);
 
-  printf("Switched to workspace %d\n", workspace_index);
+  // Focus the window under the pointer, focus follows the mouse there as
+  // soon as it shows up anyway. Otherwise what was focused last time
+  WindowInfo *under = client_at(dpy, new_layout, pointer_x, pointer_y);
+  Window previous = focus_history_first(&new_layout->history);
+  if (under) {
+    focus_client(dpy, new_layout, under);
+  } else if (previous != None) {
+    focus_window(dpy, previous);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long long elapsed = (end.tv_sec - start.tv_sec) * 1000000000LL +
+                      (end.tv_nsec - start.tv_nsec);
+  stats.workspace_switches++;
+  stats.switch_ns += elapsed;
+
+  printf("Switched to workspace %d in %lld us (%s)\n", workspace_index,
+         elapsed / 1000, config.park_hidden_windows ? "park" : "unmap");
+}
+
+// Focused before it's mapped, given input focus after
+void map_new_window(Display *dpy, TilingLayout *layout, WindowInfo *info) {
+  end_focus_cycle();
+  draw_focus(dpy, layout, info);
+  XMapWindow(dpy, info->window);
+  set_wm_state(dpy, info->window, NormalState);
+  give_input_focus(dpy, layout, info);
+  focus_history_touch(&layout->history, info->focus_node);
 }
 
-void add_window_to_current_workspace(Display *dpy, Window window) {
+void add_window_to_current_workspace(Display *dpy, Window window,
+                                     const WindowProperties *props) {
   TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
-  add_window_to_layout(dpy, window, current_layout);
-  XMapWindow(dpy, window);
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  add_window_to_layout(dpy, window, current_layout, props);
+
+  // Docks (and windows over the limit) aren't in the layout, they only
+  // change the room the tiles have
+  WindowInfo *info = find_window_info(current_layout, window);
+  if (!info) {
+    XMapWindow(dpy, window);
+    set_wm_state(dpy, window, NormalState);
+    relayout(dpy);
+    return;
+  }
 
-  if (is_floating_window(dpy, window)) {
+  // Its place, border and stacking are settled before it's mapped, and the
+  // other tiles make room in the same batch, so it's drawn once, at its
+  // final size and already focused. In an event batch that all happens at
+  // the end, together with the other windows mapped in it
+  if (info->is_floating) {
     manage_floating_window(dpy, window);
-  } else {
-    arrange_window(dpy, DisplayWidth(dpy, DefaultScreen(dpy)),
-                   DisplayHeight(dpy, DefaultScreen(dpy)));
+  }
+  if (in_batch && num_maps_due < EVENT_BATCH_SIZE) {
+    if (!is_map_due(window)) {
+      maps_due[num_maps_due++] = window;
+    }
+    relayout_due |= !info->is_floating;
+    return;
+  }
+  if (!info->is_floating) {
+    arrange_window(dpy);
     apply_layout(dpy);
   }
+  map_new_window(dpy, current_layout, info);
 
   update_client_list(dpy, RootWindow(dpy, DefaultScreen(dpy)),
                      current_layout->windows, current_layout->count);
 }
 
-void remove_window_from_current_workspace(Display *dpy, Window window) {
+// Tiles once for everything the batch changed, then shows the windows that
+// asked to be mapped in it. Only the last one is focused, the others are
+// mapped with the border they already have, or on a monocle workspace stay
+// behind the shown tile without ever being mapped
+void finish_batch(Display *dpy) {
+  in_batch = false;
+  if (relayout_due) {
+    relayout_due = false;
+    arrange_window(dpy);
+    apply_layout(dpy);
+  }
+
+  if (num_maps_due == 0) {
+    return;
+  }
   TilingLayout *current_layout =
-      &workspace_manager.layouts[workspace_manager.current_workspace];
-  remove_window_from_layout(window, current_layout, dpy);
-  XUnmapWindow(dpy, window);
-  arrange_window(dpy, DisplayWidth(dpy, DefaultScreen(dpy)),
-                 DisplayHeight(dpy, DefaultScreen(dpy)));
-  apply_layout(dpy);
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  WindowInfo *last = NULL;
+  for (int i = 0; i < num_maps_due; i++) {
+    // It may have been withdrawn or destroyed later in the batch
+    WindowInfo *info = find_window_info(current_layout, maps_due[i]);
+    if (!info) {
+      continue;
+    }
+    if (last) {
+      if (is_monocle_tab(current_layout, last - current_layout->windows)) {
+        last->is_hidden = 1;
+        set_wm_state(dpy, last->window, IconicState);
+        update_net_wm_state(dpy, last);
+      } else {
+        XRaiseWindow(dpy, last->window);
+        XMapWindow(dpy, last->window);
+        set_wm_state(dpy, last->window, NormalState);
+      }
+      focus_history_touch(&current_layout->history, last->focus_node);
+    }
+    last = info;
+  }
+  if (last) {
+    map_new_window(dpy, current_layout, last);
+  }
+  num_maps_due = 0;
   update_client_list(dpy, RootWindow(dpy, DefaultScreen(dpy)),
                      current_layout->windows, current_layout->count);
 }
 
+// The window went away on its own (withdrawn or destroyed), from whichever
+// workspace it's on. Only the current one needs tiling again
+void forget_window(Display *dpy, TilingLayout *layout, Window window) {
+  WindowInfo *info = find_window_info(layout, window);
+  pid_t pid = info && info->has_details ? info->details.pid : 0;
+  if (info) {
+    window_departed(info);
+  }
+  remove_window_from_layout(window, layout, dpy);
+  if (pid > 0 && config.freeze_workspaces) {
+    thaw_if_windowless(pid);
+  }
+  if (layout ==
+      &workspace_manager->layouts[workspace_manager->current_workspace]) {
+    relayout(dpy);
+    update_client_list(dpy, RootWindow(dpy, DefaultScreen(dpy)),
+                       layout->windows, layout->count);
+  }
+}
+
+// The managed window and its workspace, wherever it is
+WindowInfo *find_managed_window(Window window, TilingLayout **layout) {
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    WindowInfo *info =
+        find_window_info(&workspace_manager->layouts[w], window);
+    if (info) {
+      *layout = &workspace_manager->layouts[w];
+      return info;
+    }
+  }
+  return NULL;
+}
+
+// Worker results
+// New WM_NORMAL_HINTS, a tiled window on screen gets its tile fitted to them
+void apply_size_hints(Display *dpy, const ClientDetails *details) {
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(details->window, &layout);
+  if (!info) {
+    return;
+  }
+
+  info->hints = details->hints;
+  int w = layout - workspace_manager->layouts;
+  if (w == workspace_manager->current_workspace && !info->is_floating) {
+    relayout(dpy);
+  }
+}
+
+// A dock's new strut, the work area follows
+void apply_strut(Display *dpy, const ClientDetails *details) {
+  Dock *dock = find_dock(details->window);
+  if (!dock) {
+    return;
+  }
+
+  memcpy(dock->strut, details->strut, sizeof(dock->strut));
+  if (update_work_area(dpy)) {
+    relayout(dpy);
+  }
+}
+
+void apply_client_details(Display *dpy, ClientDetails *details) {
+  if (details->fetch == FETCH_SIZE_HINTS) {
+    apply_size_hints(dpy, details);
+    return;
+  }
+  if (details->fetch == FETCH_STRUT) {
+    apply_strut(dpy, details);
+    return;
+  }
+
+  job_window_mapped(details->pid);
+
+  // The window may have moved workspace or be gone by now
+  WindowInfo *info = NULL;
+  for (int w = 0; w < MAX_WORKSPACES && !info; w++) {
+    info = find_window_info(&workspace_manager->layouts[w], details->window);
+  }
+  if (!info) {
+    credit_departed_window(details);
+    return;
+  }
+
+  info->details = *details;
+  info->has_details = 1;
+  credit_client(details, &info->activity);
+
+  // Some apps (firefox) fight the layout if their configure requests are
+  // honoured
+  info->skip_configure = strcmp(details->name, "firefox") == 0;
+
+  printf("Window 0x%lx is %s (%s, pid %d)\n", details->window,
+         details->wm_class[0] ? details->wm_class : "?",
+         details->command[0] ? details->command : "?", details->pid);
+}
+
+void handle_worker_results(Display *dpy) {
+  ClientDetails details;
+
+  drain(worker->results_fd);
+  while (work_queue_pop(&worker->results, &details)) {
+    trace_client_details(dpy, &details, sizeof(details));
+    apply_client_details(dpy, &details);
+  }
+}
+
 void setup_keybindings(Display *dpy, Window root) {
   // Grab key
-  for (int i = 0; i < NUM_KEYBINDINGS; i++) {
-    KeyCode keycode = XKeysymToKeycode(dpy, keybindings[i].keysym);
-    XGrabKey(dpy, keycode, keybindings[i].modifier, root, True, GrabModeAsync,
-             GrabModeAsync);
+  for (int i = 0; i < config.num_keybindings; i++) {
+    KeyCode keycode = XKeysymToKeycode(dpy, config.keybindings[i].keysym);
+    XGrabKey(dpy, keycode, config.keybindings[i].modifier, root, True,
+             GrabModeAsync, GrabModeAsync);
   }
 
   // Grab Moving and resizing keybinds
-  XGrabButton(dpy, MOVE_BUTTON, MODIFIER, root, True, ButtonPressMask,
+  XGrabButton(dpy, MOVE_BUTTON, config.modifier, root, True, ButtonPressMask,
               GrabModeAsync, GrabModeAsync, None, None);
-  XGrabButton(dpy, RESIZE_BUTTON, MODIFIER, root, True, ButtonPressMask,
+  XGrabButton(dpy, RESIZE_BUTTON, config.modifier, root, True, ButtonPressMask,
               GrabModeAsync, GrabModeAsync, None, None);
 
   // Window keybindings
-  XGrabKey(dpy, XKeysymToKeycode(dpy, KILL_KEY), MODIFIER, root, True,
-           GrabModeAsync, GrabModeAsync);
+  XGrabKey(dpy, XKeysymToKeycode(dpy, config.kill_key), config.modifier, root,
+           True, GrabModeAsync, GrabModeAsync);
 
   // Focus keybindings
-  XGrabKey(dpy, XKeysymToKeycode(dpy, NEXT_WINDOW_KEY), MODIFIER, root, True,
-           GrabModeAsync, GrabModeAsync);
-  XGrabKey(dpy, XKeysymToKeycode(dpy, PREV_WINDOW_KEY), MODIFIER, root, True,
-           GrabModeAsync, GrabModeAsync);
+  XGrabKey(dpy, XKeysymToKeycode(dpy, config.next_window_key), config.modifier,
+           root, True, GrabModeAsync, GrabModeAsync);
+  XGrabKey(dpy, XKeysymToKeycode(dpy, config.prev_window_key), config.modifier,
+           root, True, GrabModeAsync, GrabModeAsync);
+  XGrabKey(dpy, XKeysymToKeycode(dpy, config.mru_window_key), config.modifier,
+           root, True, GrabModeAsync, GrabModeAsync);
+  KeySym direction_keys[] = {config.focus_left_key, config.focus_right_key,
+                             config.focus_up_key, config.focus_down_key};
+  for (int i = 0; i < 4; i++) {
+    XGrabKey(dpy, XKeysymToKeycode(dpy, direction_keys[i]), config.modifier,
+             root, True, GrabModeAsync, GrabModeAsync);
+  }
+
+  // Layout keybindings
+  XGrabKey(dpy, XKeysymToKeycode(dpy, config.monocle_key), config.modifier,
+           root, True, GrabModeAsync, GrabModeAsync);
+}
+
+// Applies a freshly loaded config, only redoing the work whose inputs changed
+void apply_config(Display *dpy, Window root, Config *new_config) {
+  resolve_config_colors(dpy, new_config);
+
+  bool keys_changed = !keybindings_equal(&config, new_config);
+  bool layout_changed = config.inner_gap != new_config->inner_gap ||
+                        config.outer_gap != new_config->outer_gap;
+  bool colors_changed =
+      config.border_pixel != new_config->border_pixel ||
+      config.inactive_border_pixel != new_config->inactive_border_pixel;
+  bool border_width_changed = config.border_width != new_config->border_width;
+  bool freeze_changed =
+      config.freeze_workspaces != new_config->freeze_workspaces ||
+      config.freeze_grace != new_config->freeze_grace ||
+      config.num_freeze_exempt != new_config->num_freeze_exempt;
+  for (int i = 0; i < config.num_freeze_exempt && !freeze_changed; i++) {
+    freeze_changed =
+        strcmp(config.freeze_exempt[i], new_config->freeze_exempt[i]) != 0;
+  }
+  // Only the first display runs pools. Jobs and the default layout only
+  // matter at startup
+  bool pools_changed =
+      display_index == 0 && !pools_equal(&config, new_config);
+
+  free_config_colors(dpy, &config);
+  free_config(&config);
+  config = *new_config;
+
+  if (keys_changed) {
+    XUngrabKey(dpy, AnyKey, AnyModifier, root);
+    XUngrabButton(dpy, AnyButton, AnyModifier, root);
+    setup_keybindings(dpy, root);
+    printf("Keybindings reloaded\n");
+  }
+
+  if (border_width_changed) {
+    for (int w = 0; w < MAX_WORKSPACES; w++) {
+      TilingLayout *ws = &workspace_manager->layouts[w];
+      for (int i = 0; i < ws->count; i++) {
+        ws->windows[i].border_width = config.border_width;
+        XSetWindowBorderWidth(dpy, ws->windows[i].window, config.border_width);
+      }
+    }
+  }
+
+  if (colors_changed) {
+    TilingLayout *current_layout =
+        &workspace_manager->layouts[workspace_manager->current_workspace];
+    for (int i = 0; i < current_layout->count; i++) {
+      Window win = current_layout->windows[i].window;
+      XSetWindowBorder(dpy, win,
+                       win == focused_window ? config.border_pixel
+                                             : config.inactive_border_pixel);
+    }
+  }
+
+  if (layout_changed) {
+    arrange_window(dpy);
+    apply_layout(dpy);
+  }
+
+  if (pools_changed) {
+    restart_pools(&config);
+    printf("Pools restarted\n");
+  }
+
+  // Start over with the new rules, each hidden workspace is looked at again
+  if (freeze_changed) {
+    thaw_all(false);
+    for (int w = 0; w < MAX_WORKSPACES; w++) {
+      workspace_manager->layouts[w].sampled_at = 0;
+      workspace_manager->layouts[w].frozen = false;
+    }
+  }
+}
+
+void reload_config(Display *dpy, Window root) {
+  Config new_config;
+  if (!load_config_file(&new_config, config_path)) {
+    fprintf(stderr, "Couldn't read %s, keeping current config\n",
+            config_path);
+    free_config(&new_config);
+    return;
+  }
+
+  apply_config(dpy, root, &new_config);
+  printf("Reloaded %s\n", config_path);
+}
+
+void handle_config_change(Display *dpy, Window root) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  ssize_t len;
+
+  char dir[PATH_MAX];
+  config_dir(dir, sizeof(dir));
+  const char *dir_name = strrchr(dir, '/') ? strrchr(dir, '/') + 1 : dir;
+
+  // Drain everything queued so a burst of writes reloads only once
+  while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *ptr = buf; ptr < buf + len;) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+      if (event->wd == config_dir_watch) {
+        if (event->len && strcmp(event->name, config_name) == 0) {
+          changed = true;
+        }
+      } else if (config_dir_watch < 0 && event->len &&
+                 strcmp(event->name, dir_name) == 0 && watch_config_dir()) {
+        // The directory was just made, the file may already be in there
+        printf("Watching %s for config changes\n", dir);
+        changed |= access(config_path, R_OK) == 0;
+      }
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  if (changed) {
+    reload_config(dpy, root);
+  }
 }
 
 // Set Cursor font to avoid no cursor
@@ -673,28 +4015,240 @@ void set_default_cursor(Display *dpy, Window root) {
   XFlush(dpy);
 }
 
+// Docks
+// Returns true if the window was a dock
+bool remove_dock(Display *dpy, Window window) {
+  Dock *dock = find_dock(window);
+  if (!dock) {
+    return false;
+  }
+
+  *dock = docks[--num_docks];
+  if (update_work_area(dpy)) {
+    relayout(dpy);
+  }
+  return true;
+}
+
+void handle_property_notify(XEvent ev, Display *dpy) {
+  XPropertyEvent *prop = &ev.xproperty;
+
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(prop->window, &layout);
+  if (info) {
+    window_activity(info)->property_changes++;
+    // Reading them is a round trip, the worker does it and the relayout
+    // waits for its answer (a replay gets that from the trace)
+    if (prop->atom == XA_WM_NORMAL_HINTS) {
+      request_from_worker(info->window, FETCH_SIZE_HINTS);
+    }
+    return;
+  }
+
+  if (prop->atom == net_wm_strut || prop->atom == net_wm_strut_partial) {
+    // A round trip too, or two without one, the work area changes once the
+    // worker has read it
+    if (find_dock(prop->window)) {
+      request_from_worker(prop->window, FETCH_STRUT);
+    }
+  }
+}
+
 // Map window
+pid_t get_window_pid(Display *dpy, Window window) {
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char *prop = NULL;
+  pid_t pid = -1;
+
+  if (XGetWindowProperty(dpy, window, net_wm_pid, 0, 1, False, XA_CARDINAL,
+                         &actual_type, &actual_format, &nitems, &bytes_after,
+                         &prop) == Success &&
+      prop) {
+    if (actual_format == 32 && nitems == 1) {
+      pid = *(long *)prop;
+    }
+    XFree(prop);
+  }
+  return pid;
+}
+
+void manage_window(Display *dpy, Window window,
+                   const WindowProperties *props) {
+  printf("Mapping window 0x%lx\n", window);
+  XSelectInput(dpy, window,
+               EnterWindowMask | FocusChangeMask | StructureNotifyMask |
+                   PropertyChangeMask);
+  // Tiles, focuses and maps it
+  add_window_to_current_workspace(dpy, window, props);
+
+  // What it asked for before it was mapped is the window's now
+  PendingWindow *pending = find_pending_window(window);
+  if (pending) {
+    TilingLayout *layout;
+    WindowInfo *info = find_managed_window(window, &layout);
+    add_activity(info ? &info->activity : &client_table->clients[0].activity,
+                 &pending->activity);
+    remove_pending_window(window);
+  }
+}
+
 void handle_map_request(XEvent ev, Display *dpy) {
-  XWindowAttributes attr;
-  XGetWindowAttributes(dpy, ev.xmaprequest.window, &attr);
+  Window window = ev.xmaprequest.window;
 
-  if (attr.override_redirect) {
+  // Override redirect windows are mapped directly and never get here, this
+  // only catches ones that changed their mind after being created
+  PendingWindow *pending = find_pending_window(window);
+  if (pending && pending->override_redirect) {
     printf("Override redirect, skipping window\n");
     return;
   }
 
-  printf("Mapping window 0x%lx\n", ev.xmaprequest.window);
-  XSelectInput(dpy, ev.xmaprequest.window,
-               EnterWindowMask | FocusChangeMask | StructureNotifyMask);
-  // Maps window and tiles it
-  add_window_to_current_workspace(dpy, ev.xmaprequest.window);
+  WindowProperties props;
+  read_window_properties(dpy, window, &props);
+
+  // Pool instances and timed launches are recognised by process group. That
+  // takes a round trip, so only while one of them is expecting a window
+  if (pool_waiting_for_window() || launch_waiting_for_window()) {
+    pid_t pid = get_window_pid(dpy, window);
+    pid_t group = pid > 0 ? getpgid(pid) : -1;
+    if (group > 0 && !props.is_dock &&
+        pool_hold_window(window, group, &props)) {
+      return;
+    }
+    if (group > 0) {
+      match_launch(window, group);
+    }
+  }
+
+  manage_window(dpy, window, &props);
+
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(window, &layout);
+  if (info) {
+    window_activity(info)->map_requests++;
+  } else {
+    client_table->clients[0].activity.map_requests++;
+  }
+}
+
+// Runs a binding's command, straight out of a pool if there's a warm instance
+void launch_command(Display *dpy, const char *command) {
+  WindowProperties props;
+  Window window = pool_take(command, &props);
+  if (window != None) {
+    track_launch(window, 0, true);
+    manage_window(dpy, window, &props);
+    // Only the size hints are likely to have changed while it waited
+    request_from_worker(window, FETCH_SIZE_HINTS);
+    printf("Executed command: %s (warm)\n", command);
+    return;
+  }
+
+  pid_t pid = spawn_command(command);
+  if (pid > 0) {
+    track_launch(None, pid, false);
+  }
+  printf("Executed command: %s\n", command);
+}
+
+void handle_unmap_request(XEvent ev, Display *dpy) {
+  // Managed windows report each unmap twice, once to the root and once to
+  // themselves. Withdrawals (synthetic) are sent to the root
+  if (ev.xunmap.event != RootWindow(dpy, DefaultScreen(dpy))) {
+    return;
+  }
+
+  if (remove_dock(dpy, ev.xunmap.window)) {
+    return;
+  }
+
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(ev.xunmap.window, &layout);
+  if (!info) {
+    return;
+  }
+
+  // Hiding it for a workspace switch or a monocle swap
+  if (!ev.xunmap.send_event && info->expected_unmaps > 0) {
+    info->expected_unmaps--;
+    stats.own_unmaps_ignored++;
+    return;
+  }
+
+  // The client withdrew it, tile everything else, focus falls back on its own
+  set_wm_state(dpy, ev.xunmap.window, WithdrawnState);
+  forget_window(dpy, layout, ev.xunmap.window);
+  stats.windows_withdrawn++;
+}
+
+// A window destroyed while hidden never unmaps first
+void handle_destroy_notify(XEvent ev, Display *dpy) {
+  TilingLayout *layout;
+  if (find_managed_window(ev.xdestroywindow.window, &layout)) {
+    forget_window(dpy, layout, ev.xdestroywindow.window);
+    stats.windows_destroyed++;
+  }
+}
+
+// A client that keeps asking for a geometry the layout won't give it can end
+// up ping-ponging with moody. Past CONFIGURE_RATE_LIMIT requests a second its
+// requests are dropped until the second is over
+bool allow_configure_request(WindowInfo *info) {
+  long long now = now_ns();
+  if (now - info->configure_period_start > 1000000000LL) {
+    info->configure_period_start = now;
+    info->configure_period_count = 0;
+  }
+
+  info->configure_period_count++;
+  if (info->configure_period_count <= CONFIGURE_RATE_LIMIT) {
+    return true;
+  }
+
+  if (info->configure_period_count == CONFIGURE_RATE_LIMIT + 1) {
+    stats.configure_loops_broken++;
+    printf("Window 0x%lx is stuck in a configure loop, ignoring it for now\n",
+           info->window);
+  }
+  stats.configure_requests_dropped++;
+  return false;
+}
+
+// Tells a client where it actually is, as ICCCM asks for when a configure
+// request isn't honoured. That's the server's geometry, a parked window isn't
+// where its tile is
+void send_configure_notify(Display *dpy, WindowInfo *info) {
+  bool known = info->server_width > 0;
+  XConfigureEvent ce = {
+      .type = ConfigureNotify,
+      .display = dpy,
+      .event = info->window,
+      .window = info->window,
+      .x = known ? info->server_x : info->x,
+      .y = known ? info->server_y : info->y,
+      .width = known ? info->server_width : info->width,
+      .height = known ? info->server_height : info->height,
+      .border_width = info->border_width,
+      .above = None,
+      .override_redirect = False,
+  };
+  XSendEvent(dpy, info->window, False, StructureNotifyMask, (XEvent *)&ce);
+  stats.synthetic_configure_notifies++;
 }
 
-void handle_unmap_request(XEvent ev, Display *dpy) {
-  // Unmaps window and tiles everything else
-  remove_window_from_current_workspace(dpy, ev.xunmap.window);
+// Handled or merged into a later one in its batch, the client asked
+void count_configure_request(Window window) {
+  stats.configure_requests++;
 
-  focus_next_window(dpy);
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(window, &layout);
+  if (info) {
+    window_activity(info)->configure_requests++;
+  } else {
+    unmanaged_activity(window)->configure_requests++;
+  }
 }
 
 void handle_configure_request(XEvent ev, Display *dpy) {
@@ -705,42 +4259,108 @@ void handle_configure_request(XEvent ev, Display *dpy) {
   changes.width = req->width;
   changes.height = req->height;
   changes.border_width = req->border_width;
+  changes.sibling = req->above;
+  changes.stack_mode = req->detail;
 
   printf("Configure request: window 0x%lx, (%d, %d, %d, %d)\n", req->window,
          req->x, req->y, req->width, req->height);
+  count_configure_request(req->window);
 
-  // Determine if this window should have `XConfigureWindow` applied
-  char *window_name = NULL;
-  XFetchName(dpy, req->window, &window_name);
-  int should_configure = 1;
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(req->window, &layout);
 
-  if (window_name) {
-    if (strcmp(window_name, "firefox") == 0) {
-      should_configure = 0; // Skip Firefox
-    }
-    XFree(window_name);
+  // Not managed yet, it can have whatever it likes
+  if (!info) {
+    XConfigureWindow(dpy, req->window, req->value_mask, &changes);
+    return;
   }
 
-  // If not Firefox or similar apps, apply configuration
-  if (should_configure) {
-    XConfigureWindow(dpy, req->window, req->value_mask, &changes);
+  if (!allow_configure_request(info)) {
+    return;
   }
 
-  // Regardless, maintain the internal layout
-  for (int i = 0; i < layout.count; i++) {
-    if (layout.windows[i].window == req->window) {
-      layout.windows[i].x = changes.x;
-      layout.windows[i].y = changes.y;
-      layout.windows[i].width = changes.width;
-      layout.windows[i].height = changes.height;
-      break;
+  // The layout decides the size of tiled windows, so don't re-layout, just
+  // tell the client the geometry it already has
+  if (!info->is_floating || info->is_fullscreen || info->is_hidden) {
+    send_configure_notify(dpy, info);
+    return;
+  }
+
+  // If not Firefox or similar apps, apply configuration. The internal
+  // geometry catches up from the ConfigureNotify
+  if (info->skip_configure) {
+    send_configure_notify(dpy, info);
+    return;
+  }
+  constrain_to_size_hints(info, &changes.width, &changes.height);
+  XConfigureWindow(dpy, req->window, req->value_mask, &changes);
+}
+
+// Keeps the internal geometry in sync with what the server actually did
+void handle_configure_notify(XEvent ev, Display *dpy) {
+  XConfigureEvent *conf = &ev.xconfigure;
+
+  // Our own synthetic notifies, nothing new in there
+  if (conf->send_event) {
+    return;
+  }
+
+  PendingWindow *pending = find_pending_window(conf->window);
+  if (pending) {
+    pending->x = conf->x;
+    pending->y = conf->y;
+    pending->width = conf->width;
+    pending->height = conf->height;
+    return;
+  }
+
+  // Anything that far left is sitting in the parking lot, and its real
+  // position is the one to restore later
+  if (conf->x <= -DisplayWidth(dpy, DefaultScreen(dpy))) {
+    return;
+  }
+
+  TilingLayout *layout;
+  WindowInfo *info = find_managed_window(conf->window, &layout);
+  if (info && !info->is_parked) {
+    info->x = info->server_x = conf->x;
+    info->y = info->server_y = conf->y;
+    info->width = info->server_width = conf->width;
+    info->height = info->server_height = conf->height;
+    layout->index.dirty = true;
+  }
+}
+
+void handle_focus_in(XEvent ev, Display *dpy) {
+  if (ev.xfocus.detail == NotifyPointer) {
+    return;
+  }
+
+  // Clients may move focus themselves, follow along
+  TilingLayout *current_workspace =
+      &workspace_manager->layouts[workspace_manager->current_workspace];
+  WindowInfo *info = find_window_info(current_workspace, ev.xfocus.window);
+  if (!info || is_map_due(ev.xfocus.window)) {
+    return;
+  }
+  // Nothing to redraw if moody moved focus there itself
+  if (focused_window != ev.xfocus.window) {
+    if (focused_window != None) {
+      draw_window_border(dpy, focused_window, config.border_width,
+                         config.inactive_border_pixel);
     }
+    draw_window_border(dpy, ev.xfocus.window, config.border_width,
+                       config.border_pixel);
   }
+  focused_window = ev.xfocus.window;
+  current_workspace->focus_index = info - current_workspace->windows;
 
-  arrange_window(dpy, DisplayWidth(dpy, DefaultScreen(dpy)),
-                 DisplayHeight(dpy, DefaultScreen(dpy)));
-  apply_layout(dpy);
-  XSync(dpy, False);
+  // Our own focus change during a cycle comes back here too
+  if (mru_cycle_node >= 0 && info->focus_node == mru_cycle_node) {
+    return;
+  }
+  end_focus_cycle();
+  focus_history_touch(&current_workspace->history, info->focus_node);
 }
 
 // Handle moving and resizing
@@ -750,16 +4370,14 @@ void start_drag(Display *dpy, XEvent ev, DragState *drag) {
     drag->start_x = ev.xbutton.x_root;
     drag->start_y = ev.xbutton.y_root;
 
-    XWindowAttributes attr;
-    XGetWindowAttributes(dpy, drag->window, &attr);
-    drag->x = attr.x;
-    drag->y = attr.y;
-    drag->width = attr.width;
-    drag->height = attr.height;
+    get_window_geometry(dpy, drag->window, &drag->x, &drag->y, &drag->width,
+                        &drag->height);
     drag->is_resizing = (ev.xbutton.button == RESIZE_BUTTON);
 
-    XGrabPointer(dpy, drag->window, True, PointerMotionMask | ButtonReleaseMask,
-                 GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+    // The press already activated the passive grab from setup_keybindings,
+    // so just widen it to get motion (XGrabPointer would wait for a reply)
+    XChangeActivePointerGrab(dpy, PointerMotionMask | ButtonReleaseMask, None,
+                             CurrentTime);
 
     printf("Starting %s on window 0x%lx\n",
            drag->is_resizing ? "resize" : "move", drag->window);
@@ -783,6 +4401,12 @@ void update_drag(Display *dpy, XEvent ev, DragState *drag) {
 
 void end_drag(Display *dpy, DragState *drag) {
   if (drag->window != None) {
+    // Dragged away from its tile, the next layout has to put it back
+    TilingLayout *layout;
+    WindowInfo *info = find_managed_window(drag->window, &layout);
+    if (info) {
+      info->server_width = 0;
+    }
     XUngrabPointer(dpy, CurrentTime);
     drag->window = None;
     printf("Drag ended\n");
@@ -790,11 +4414,10 @@ void end_drag(Display *dpy, DragState *drag) {
 }
 
 void close_window(Display *dpy, Window window) {
-  Atom wm_delete_window = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
   XEvent event;
   event.type = ClientMessage;
   event.xclient.window = window;
-  event.xclient.message_type = XInternAtom(dpy, "WM_PROTOCOLS", True);
+  event.xclient.message_type = wm_protocols;
   event.xclient.format = 32;
   event.xclient.data.l[0] = wm_delete_window;
   event.xclient.data.l[1] = CurrentTime;
@@ -802,13 +4425,7 @@ void close_window(Display *dpy, Window window) {
 }
 
 void kill_focused_window(Display *dpy) {
-  Window focused_window;
-  int revert_to;
-
-  // Get the currently focused window
-  XGetInputFocus(dpy, &focused_window, &revert_to);
-
-  if (focused_window != None && focused_window != PointerRoot) {
+  if (focused_window != None) {
     close_window(dpy, focused_window);
     printf("Killed window 0x%lx\n", focused_window);
   } else {
@@ -820,37 +4437,55 @@ void handle_keypress_event(XEvent ev, Display *dpy) {
   KeySym keysym = XkbKeycodeToKeysym(dpy, ev.xkey.keycode, 0, 0);
 
   // Kill focused window
-  if (keysym == KILL_KEY && (ev.xkey.state & MODIFIER)) {
+  if (keysym == config.kill_key && (ev.xkey.state & config.modifier)) {
     kill_focused_window(dpy);
     return;
   }
 
   // Focus next window
-  if (keysym == NEXT_WINDOW_KEY && (ev.xkey.state & MODIFIER)) {
+  if (keysym == config.next_window_key && (ev.xkey.state & config.modifier)) {
     focus_next_window(dpy);
     return;
   }
 
   // Focus previous window
-  if (keysym == PREV_WINDOW_KEY && (ev.xkey.state & MODIFIER)) {
+  if (keysym == config.prev_window_key && (ev.xkey.state & config.modifier)) {
     focus_prev_window(dpy);
     return;
   }
 
+  // Go back through the focus history
+  if (keysym == config.mru_window_key && (ev.xkey.state & config.modifier)) {
+    focus_mru_window(dpy);
+    return;
+  }
+
+  // Switch between tiling and monocle
+  if (keysym == config.monocle_key && (ev.xkey.state & config.modifier)) {
+    toggle_monocle(dpy);
+    return;
+  }
+
+  // Focus the nearest window in a direction
+  KeySym direction_keys[] = {config.focus_left_key, config.focus_right_key,
+                             config.focus_up_key, config.focus_down_key};
+  for (int i = 0; i < 4; i++) {
+    if (keysym == direction_keys[i] && (ev.xkey.state & config.modifier)) {
+      focus_direction(dpy, i);
+      return;
+    }
+  }
+
   // Get all keybindings for programs
-  for (int i = 0; i < NUM_KEYBINDINGS; i++) {
-    if (keysym == keybindings[i].keysym &&
-        (ev.xkey.state & keybindings[i].modifier)) {
-      if (keybindings[i].workspace != -1 && (ev.xkey.state & ShiftMask)) {
-        move_window_to_workspace(dpy, keybindings[i].workspace);
-      } else if (keybindings[i].workspace != -1) {
-        switch_workspace(dpy, keybindings[i].workspace);
-      } else if (keybindings[i].command) {
-        // Execute the command
-        char command[256];
-        snprintf(command, sizeof(command), "%s &", keybindings[i].command);
-        system(command);
-        printf("Executed command: %s\n", keybindings[i].command);
+  for (int i = 0; i < config.num_keybindings; i++) {
+    Keybinding *binding = &config.keybindings[i];
+    if (keysym == binding->keysym && (ev.xkey.state & binding->modifier)) {
+      if (binding->workspace != -1 && (ev.xkey.state & ShiftMask)) {
+        move_window_to_workspace(dpy, binding->workspace);
+      } else if (binding->workspace != -1) {
+        switch_workspace(dpy, binding->workspace);
+      } else if (binding->command) {
+        launch_command(dpy, binding->command);
       }
       return;
     }
@@ -864,6 +4499,15 @@ void handle_client_message(XEvent *e, Display *dpy) {
     bool add = e->xclient.data.l[0] == 1;
 
     if (state == net_wm_state_fullscreen) {
+      WindowInfo *info = find_window_info(
+          &workspace_manager->layouts[workspace_manager->current_workspace],
+          window);
+      if (info) {
+        info->is_fullscreen = add;
+        info->server_width = 0;
+        update_net_wm_state(dpy, info);
+      }
+
       if (add) {
         XWindowChanges changes;
 
@@ -875,82 +4519,650 @@ void handle_client_message(XEvent *e, Display *dpy) {
                           XDisplayHeight(dpy, DefaultScreen(dpy)));
         XConfigureWindow(dpy, window, CWBorderWidth, &changes);
       } else {
-        // Exit fullscreen
-        draw_window_border(dpy, window, BORDER_WIDTH, BORDER_COLOR);
+        // Exit fullscreen, a tiled window goes back into its tile
+        draw_window_border(dpy, window, config.border_width,
+                           config.border_pixel);
+        if (info && !info->is_floating) {
+          relayout(dpy);
+        }
       }
     }
   }
   // Handle other client messages as needed
 }
 
-void handle_events(Display *dpy, Window root, int scr) {
-  DragState drag = {0};
-  XEvent ev;
-  for (;;) {
-    XNextEvent(dpy, &ev);
+// Stats
+// The signal lands on whichever thread, every display's loop is woken up
+static void wake_displays() {
+  int saved_errno = errno;
+  for (int i = 0; i < num_displays; i++) {
+    if (display_wake_fds[i] >= 0) {
+      wake(display_wake_fds[i]);
+    }
+  }
+  errno = saved_errno;
+}
 
-    switch (ev.type) {
-    case MapRequest:
-      printf("Map Request\n");
-      handle_map_request(ev, dpy);
-      focus_window(dpy, ev.xmaprequest.window);
-      break;
-    case UnmapNotify:
-      printf("Unmap Notify\n");
-      handle_unmap_request(ev, dpy);
-    case ConfigureRequest:
-      printf("Configure Request\n");
-      handle_configure_request(ev, dpy);
-      break;
-    case Expose:
-      if (ev.xexpose.count == 0) {
-        XClearWindow(dpy, ev.xexpose.window);
-      }
-    case EnterNotify:
-      if (ev.xcrossing.window != root) {
-        printf("Mouse entered window 0x%lx, raising and focusing it\n",
-               ev.xcrossing.window);
-
-        focus_window(dpy, ev.xcrossing.window);
-        for (int i = 0; i < layout.count; i++) {
-          if (layout.windows[i].is_floating) {
-            XRaiseWindow(dpy, layout.windows[i].window);
+void handle_sigusr1(int sig) {
+  stats_requested++;
+  wake_displays();
+}
+
+void handle_sigusr2(int sig) {
+  clients_requested++;
+  wake_displays();
+}
+
+void handle_sigterm(int sig) {
+  quit_requested = 1;
+  wake_displays();
+}
+
+long read_rss_kb() {
+  long pages = 0, resident = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (file) {
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(file);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Invariants
+#ifdef MOODY_DEBUG
+void report_violation(const char *what, Window window) {
+  stats.invariant_violations++;
+  fprintf(stderr, "Invariant violated: %s (window 0x%lx)\n", what, window);
+}
+
+bool rects_overlap(WindowInfo *a, WindowInfo *b) {
+  return a->x < b->x + b->width && b->x < a->x + a->width &&
+         a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+// Only meaningful once the event queue has drained, in the middle of a burst
+// the internal state is allowed to be ahead of the server
+void check_invariants() {
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    TilingLayout *ws = &workspace_manager->layouts[w];
+    bool is_current = w == workspace_manager->current_workspace;
+
+    if (ws->count < 0 || ws->count > MAX_WINDOWS) {
+      report_violation("window count out of range", None);
+      continue;
+    }
+    if ((ws->count == 0) != (ws->master == None) ||
+        (ws->master != None && !find_window_info(ws, ws->master))) {
+      report_violation("master isn't in its workspace", ws->master);
+    }
+
+    for (int i = 0; i < ws->count; i++) {
+      WindowInfo *info = &ws->windows[i];
+      if (is_current && is_monocle_tab(ws, i)) {
+        if (!info->is_hidden) {
+          report_violation("monocle tab shown", info->window);
+        }
+      } else if (info->is_hidden == is_current) {
+        report_violation(is_current ? "window on the current workspace hidden"
+                                    : "window on a hidden workspace shown",
+                         info->window);
+      }
+
+      // Every window is managed exactly once
+      for (int v = w; v < MAX_WORKSPACES; v++) {
+        TilingLayout *other = &workspace_manager->layouts[v];
+        for (int j = (v == w ? i + 1 : 0); j < other->count; j++) {
+          if (other->windows[j].window == info->window) {
+            report_violation("window managed twice", info->window);
           }
         }
       }
-      break;
-    case ButtonPress:
-      if (ev.xbutton.subwindow != None) {
-        // Resizing and Moving
-        if ((ev.xbutton.state & MODIFIER) &&
-            (ev.xbutton.button == MOVE_BUTTON ||
-             ev.xbutton.button == RESIZE_BUTTON)) {
-          start_drag(dpy, ev, &drag);
+
+      int node = info->focus_node;
+      if (node < 0 || node >= MAX_WINDOWS ||
+          ws->history.nodes[node].window != info->window) {
+        report_violation("window isn't in its focus history", info->window);
+      }
+
+      if (is_current && !info->is_floating && !info->is_fullscreen &&
+          !info->is_hidden) {
+        for (int j = i + 1; j < ws->count; j++) {
+          WindowInfo *other = &ws->windows[j];
+          if (!other->is_floating && !other->is_fullscreen &&
+              !other->is_hidden &&
+              rects_overlap(info, other)) {
+            report_violation("tiled windows overlap", info->window);
+          }
         }
       }
-      break;
-    case MotionNotify:
-      while (XCheckTypedEvent(dpy, MotionNotify, &ev))
-        ;
-      update_drag(dpy, ev, &drag);
-      break;
-    case ButtonRelease:
-      end_drag(dpy, &drag);
-      break;
-    case KeyPress:
-      handle_keypress_event(ev, dpy);
-      break;
-    case ClientMessage:
-      handle_client_message(&ev, dpy);
-      break;
-    default:
-      printf("Other event type: %d\n", ev.type);
-      break;
     }
+
+    int length = 0;
+    for (int n = ws->history.head; n >= 0 && length <= MAX_WINDOWS;
+         n = ws->history.nodes[n].next) {
+      length++;
+    }
+    if (length != ws->count) {
+      report_violation("focus history out of step with the workspace", None);
+    }
+  }
+
+  if (focused_window != None &&
+      !find_window_info(
+          &workspace_manager->layouts[workspace_manager->current_workspace],
+          focused_window)) {
+    report_violation("focused window isn't on the current workspace",
+                     focused_window);
+  }
+}
+
+// A destroyed window must already be gone from every layout
+void check_destroyed_window(Window window) {
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    if (find_window_info(&workspace_manager->layouts[w], window)) {
+      report_violation("destroyed window still managed", window);
+    }
+  }
+}
+#endif
+
+void print_stats() {
+  // Several displays may print at once, keep each one's lines together
+  flockfile(stdout);
+  printf("Stats for %s:\n", display_names[display_index]);
+  printf("  hide strategy: %s\n",
+         config.park_hidden_windows ? "park" : "unmap");
+  printf("  workspace switches: %lu (avg %llu us)\n", stats.workspace_switches,
+         stats.workspace_switches
+             ? stats.switch_ns / stats.workspace_switches / 1000
+             : 0);
+  printf("  windows mapped/unmapped: %lu/%lu\n", stats.windows_mapped,
+         stats.windows_unmapped);
+  printf("  windows parked/unparked: %lu/%lu\n", stats.windows_parked,
+         stats.windows_unparked);
+  printf("  own unmaps ignored: %lu, windows withdrawn/destroyed: %lu/%lu\n",
+         stats.own_unmaps_ignored, stats.windows_withdrawn,
+         stats.windows_destroyed);
+  printf("  tile configures sent/skipped: %lu/%lu\n",
+         stats.tile_configures_sent, stats.tile_configures_skipped);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double uptime = (now.tv_sec - stats.started.tv_sec) +
+                  (now.tv_nsec - stats.started.tv_nsec) / 1e9;
+  printf("  events handled: %lu (%.1f/s over %.0f s)\n", stats.events_handled,
+         uptime > 0 ? stats.events_handled / uptime : 0, uptime);
+  printf("  event batches: %lu (avg %.1f events, max %lu), collapsed: %lu\n",
+         stats.event_batches,
+         stats.event_batches ? (double)(stats.events_handled +
+                                        stats.events_collapsed) /
+                                   stats.event_batches
+                             : 0,
+         stats.max_batch, stats.events_collapsed);
+  printf("  input events: %lu (read to handled avg %lld us, max %lld us)\n",
+         stats.input_events,
+         stats.input_events
+             ? stats.input_wait_ns / (long long)stats.input_events / 1000
+             : 0,
+         stats.max_input_wait_ns / 1000);
+
+  long rss_kb = read_rss_kb();
+  printf("  rss: %ld kB (%+ld kB since start)\n", rss_kb,
+         rss_kb - stats.start_rss_kb);
+
+  // X resources moody owns, all of these should stay flat over time
+  int managed = 0;
+  for (int w = 0; w < MAX_WORKSPACES; w++) {
+    managed += workspace_manager->layouts[w].count;
+  }
+  printf("  managed windows: %d, pending windows: %d\n", managed,
+         num_pending_windows);
+  printf("  colors allocated/freed: %lu/%lu\n", stats.colors_allocated,
+         stats.colors_freed);
+  printf("  configure requests: %lu (%lu answered with a synthetic notify)\n",
+         stats.configure_requests, stats.synthetic_configure_notifies);
+  printf("  configure loops broken: %lu (%lu requests dropped)\n",
+         stats.configure_loops_broken, stats.configure_requests_dropped);
+  printf("  invariant violations: %lu\n", stats.invariant_violations);
+
+  int jobs_ready = 0;
+  for (int i = 0; i < supervisor.num_jobs; i++) {
+    jobs_ready += supervisor.jobs[i].ready;
+  }
+  if (display_index != 0) {
+    // Startup jobs are the first display's
+  } else if (stats.session_ready_ns) {
+    printf("  session ready in %lld ms\n", stats.session_ready_ns / 1000000);
+  } else {
+    printf("  session not ready yet (%d/%d jobs ready)\n", jobs_ready,
+           supervisor.num_jobs);
+  }
+  printf("  pool hits/misses: %lu/%lu\n", stats.pool_hits, stats.pool_misses);
+  long long frozen_ns = stats.frozen_ns, cpu_saved_ns = stats.cpu_saved_ns;
+  int frozen_now = 0;
+  pthread_mutex_lock(&frozen_lock);
+  for (int i = 0; i < num_frozen; i++) {
+    if (frozen[i].display == display_index) {
+      long long stopped = now_ns() - frozen[i].frozen_at;
+      frozen_ns += stopped;
+      cpu_saved_ns += frozen[i].cpu_share * stopped;
+      frozen_now++;
+    }
+  }
+  pthread_mutex_unlock(&frozen_lock);
+  printf("  processes stopped/continued: %lu/%lu (%d stopped now), about "
+         "%lld ms of CPU saved over %lld s stopped\n",
+         stats.processes_frozen, stats.processes_thawed, frozen_now,
+         cpu_saved_ns / 1000000, frozen_ns / 1000000000LL);
+  printf("  keypress to visible: warm %lu (avg %lld ms), cold %lu (avg %lld "
+         "ms)\n",
+         stats.warm_launches,
+         stats.warm_launches ? stats.warm_launch_ns / stats.warm_launches /
+                                   1000000
+                             : 0,
+         stats.cold_launches,
+         stats.cold_launches ? stats.cold_launch_ns / stats.cold_launches /
+                                   1000000
+                             : 0);
+  fflush(stdout);
+  funlockfile(stdout);
+}
+
+// Blocks until the X connection or the config watch has something to read
+void wait_for_events(Display *dpy, Window root) {
+  // Negative fds (features that are off) are ignored by poll
+  struct pollfd fds[] = {
+      {.fd = ConnectionNumber(dpy), .events = POLLIN},
+      {.fd = inotify_fd, .events = POLLIN},
+      {.fd = worker->results_fd, .events = POLLIN},
+      {.fd = display_index == 0 ? supervisor.child_fd : -1, .events = POLLIN},
+      {.fd = display_wake_fds[display_index], .events = POLLIN},
+  };
+
+#ifdef MOODY_DEBUG
+  check_invariants();
+#endif
+
+  XFlush(dpy);
+  trace_flush();
+  // Wake up for the next job restart, pool refill, freeze or sample too
+  int timeout = supervisor_timeout();
+  int waits[] = {pool_timeout(), freeze_timeout(), sample_timeout()};
+  for (int i = 0; i < 3; i++) {
+    if (waits[i] >= 0 && (timeout < 0 || waits[i] < timeout)) {
+      timeout = waits[i];
+    }
+  }
+  int ready = poll(fds, sizeof(fds) / sizeof(fds[0]), timeout);
+
+  // Signals are the process's, the first display acts on them for everyone
+  // and the others only print their stats
+  if (quit_requested && display_index == 0) {
+    stop_pools();
+    thaw_all(true);
+    exit(0);
+  }
+  if (ready > 0 && (fds[4].revents & POLLIN)) {
+    drain(fds[4].fd);
+  }
+  if (ready > 0 && (fds[3].revents & POLLIN)) {
+    reap_children();
+  }
+  if (display_index == 0) {
+    supervise_jobs();
+  }
+  maintain_pools();
+  maintain_freezes();
+  sample_clients();
+  expire_launches();
+
+  if (stats_printed != stats_requested) {
+    stats_printed = stats_requested;
+    print_stats();
+  }
+  if (clients_printed != clients_requested) {
+    clients_printed = clients_requested;
+    print_clients();
+  }
+  if (ready <= 0) {
+    return;
+  }
+
+  if (fds[1].revents & POLLIN) {
+    handle_config_change(dpy, root);
+  }
+  if (fds[2].revents & POLLIN) {
+    handle_worker_results(dpy);
+  }
+}
+
+#ifdef MOODY_DEBUG
+// Xlib only reads from the connection inside a handler when it's waiting
+// for a reply, so if the last sequence number it has seen moved, the handler
+// made a round trip. Mapping a new window is allowed to, nothing else is
+void check_round_trips(Display *dpy, XEvent *ev, unsigned long last_read) {
+  if (ev->type == MapRequest) {
+    return;
+  }
+
+  if (LastKnownRequestProcessed(dpy) != last_read) {
+    fprintf(stderr, "Round trip while handling event type %d\n", ev->type);
+    abort();
+  }
+}
+#endif
+
+// Input events say where the pointer is, so finding the window under it
+// never needs XQueryPointer
+void track_pointer(XEvent *ev) {
+  switch (ev->type) {
+  case KeyPress:
+  case KeyRelease:
+    pointer_x = ev->xkey.x_root;
+    pointer_y = ev->xkey.y_root;
+    break;
+  case ButtonPress:
+  case ButtonRelease:
+    pointer_x = ev->xbutton.x_root;
+    pointer_y = ev->xbutton.y_root;
+    break;
+  case MotionNotify:
+    pointer_x = ev->xmotion.x_root;
+    pointer_y = ev->xmotion.y_root;
+    break;
+  case EnterNotify:
+  case LeaveNotify:
+    pointer_x = ev->xcrossing.x_root;
+    pointer_y = ev->xcrossing.y_root;
+    break;
+  }
+}
+
+void handle_event(Display *dpy, Window root, XEvent *event, DragState *drag) {
+  XEvent ev = *event;
+  trace_event_start(ev.type);
+#ifdef MOODY_DEBUG
+  unsigned long last_read = LastKnownRequestProcessed(dpy);
+#endif
+
+  switch (ev.type) {
+  case MapRequest:
+    printf("Map Request\n");
+    handle_map_request(ev, dpy);
+    break;
+  case UnmapNotify:
+    printf("Unmap Notify\n");
+    handle_unmap_request(ev, dpy);
+    break;
+  case ConfigureRequest:
+    printf("Configure Request\n");
+    handle_configure_request(ev, dpy);
+    break;
+  case Expose:
+    if (ev.xexpose.count == 0) {
+      XClearWindow(dpy, ev.xexpose.window);
+    }
+    break;
+  case EnterNotify:
+    if (ev.xcrossing.window != root) {
+      printf("Mouse entered window 0x%lx, raising and focusing it\n",
+             ev.xcrossing.window);
+
+      focus_window(dpy, ev.xcrossing.window);
+      for (int i = 0; i < layout.count; i++) {
+        if (layout.windows[i].is_floating) {
+          XRaiseWindow(dpy, layout.windows[i].window);
+        }
+      }
+    }
+    break;
+  case ButtonPress:
+    if (ev.xbutton.subwindow != None) {
+      // Resizing and Moving
+      if ((ev.xbutton.state & config.modifier) &&
+          (ev.xbutton.button == MOVE_BUTTON ||
+           ev.xbutton.button == RESIZE_BUTTON)) {
+        start_drag(dpy, ev, drag);
+      }
+    }
+    break;
+  case MotionNotify:
+    update_drag(dpy, ev, drag);
+    break;
+  case ButtonRelease:
+    end_drag(dpy, drag);
+    break;
+  case KeyPress:
+    handle_keypress_event(ev, dpy);
+    break;
+  case KeyRelease:
+    break;
+  case ClientMessage:
+    handle_client_message(&ev, dpy);
+    break;
+  case CreateNotify:
+    add_pending_window(&ev.xcreatewindow);
+    break;
+  case DestroyNotify:
+    forget_pending_window(ev.xdestroywindow.window);
+    pool_window_destroyed(ev.xdestroywindow.window);
+    remove_dock(dpy, ev.xdestroywindow.window);
+    handle_destroy_notify(ev, dpy);
+#ifdef MOODY_DEBUG
+    check_destroyed_window(ev.xdestroywindow.window);
+#endif
+    break;
+  case ConfigureNotify:
+    handle_configure_notify(ev, dpy);
+    break;
+  case MapNotify:
+    launch_visible(ev.xmap.window);
+    break;
+  case FocusIn:
+    handle_focus_in(ev, dpy);
+    break;
+  case PropertyNotify:
+    handle_property_notify(ev, dpy);
+    break;
+  default:
+    printf("Other event type: %d\n", ev.type);
+    break;
+  }
+
+  stats.events_handled++;
+
+#ifdef MOODY_DEBUG
+  check_round_trips(dpy, &ev, last_read);
+#endif
+}
+
+// Event batches
+// Everything queued at a wakeup is read at once. Keys and buttons are handled
+// before the rest, so they don't wait behind a client's flood of requests,
+// events a later one in the batch makes pointless are dropped, and tiling
+// waits for the end of the batch (see relayout)
+static bool is_input_event(int type) {
+  return type == KeyPress || type == KeyRelease || type == ButtonPress ||
+         type == ButtonRelease || type == MotionNotify;
+}
+
+// Events about one window whose latest copy is all that counts
+static Window collapsible_window(XEvent *ev) {
+  switch (ev->type) {
+  case ConfigureRequest:
+    return ev->xconfigurerequest.window;
+  case ConfigureNotify:
+    return ev->xconfigure.window;
+  case EnterNotify:
+    return ev->xcrossing.window;
+  default:
+    return None;
+  }
+}
+
+// After these the window is managed differently, what came before stays
+static Window lifecycle_window(XEvent *ev) {
+  switch (ev->type) {
+  case CreateNotify:
+    return ev->xcreatewindow.window;
+  case MapRequest:
+    return ev->xmaprequest.window;
+  case MapNotify:
+    return ev->xmap.window;
+  case UnmapNotify:
+    return ev->xunmap.window;
+  case DestroyNotify:
+    return ev->xdestroywindow.window;
+  default:
+    return None;
+  }
+}
+
+// The later request wins, the earlier one still counts for what it set and
+// the later one didn't
+static void merge_configure_request(XConfigureRequestEvent *earlier,
+                                    XConfigureRequestEvent *later) {
+  unsigned long missing = earlier->value_mask & ~later->value_mask;
+  if (missing & CWX) {
+    later->x = earlier->x;
+  }
+  if (missing & CWY) {
+    later->y = earlier->y;
+  }
+  if (missing & CWWidth) {
+    later->width = earlier->width;
+  }
+  if (missing & CWHeight) {
+    later->height = earlier->height;
+  }
+  if (missing & CWBorderWidth) {
+    later->border_width = earlier->border_width;
+  }
+  // Sibling and stack mode only mean something together
+  if (!(later->value_mask & (CWSibling | CWStackMode))) {
+    later->above = earlier->above;
+    later->detail = earlier->detail;
+  } else {
+    missing &= ~(CWSibling | CWStackMode);
+  }
+  later->value_mask |= missing;
+}
+
+// Marks what the rest of the batch makes redundant: all but the last of a
+// run of motion events, and earlier configures and enters of a window
+static void collapse_batch(XEvent *batch, bool *dropped, int count) {
+  int last_input = -1;
+  struct {
+    Window window;
+    int type, index;
+  } latest[EVENT_BATCH_SIZE];
+  int num_latest = 0;
+
+  for (int i = 0; i < count; i++) {
+    XEvent *ev = &batch[i];
+    if (is_input_event(ev->type)) {
+      if (ev->type == MotionNotify && last_input >= 0 &&
+          batch[last_input].type == MotionNotify) {
+        dropped[last_input] = true;
+      }
+      last_input = i;
+      continue;
+    }
+
+    Window window = lifecycle_window(ev);
+    if (window != None) {
+      for (int j = 0; j < num_latest; j++) {
+        if (latest[j].window == window) {
+          latest[j--] = latest[--num_latest];
+        }
+      }
+      continue;
+    }
+
+    window = collapsible_window(ev);
+    if (window == None) {
+      continue;
+    }
+    int j = 0;
+    while (j < num_latest &&
+           (latest[j].window != window || latest[j].type != ev->type)) {
+      j++;
+    }
+    if (j == num_latest) {
+      latest[num_latest].window = window;
+      latest[num_latest].type = ev->type;
+      num_latest++;
+    } else {
+      XEvent *earlier = &batch[latest[j].index];
+      if (ev->type == ConfigureRequest) {
+        merge_configure_request(&earlier->xconfigurerequest,
+                                &ev->xconfigurerequest);
+        count_configure_request(window);
+      }
+      dropped[latest[j].index] = true;
+    }
+    latest[j].index = i;
+  }
+
+  for (int i = 0; i < count; i++) {
+    stats.events_collapsed += dropped[i];
+  }
+}
+
+void handle_events(Display *dpy, Window root, int scr) {
+  DragState drag = {0};
+  XEvent batch[EVENT_BATCH_SIZE];
+  bool dropped[EVENT_BATCH_SIZE];
+
+  for (;;) {
+    while (!XPending(dpy)) {
+      wait_for_events(dpy, root);
+    }
+
+    int count = 0;
+    while (count < EVENT_BATCH_SIZE &&
+           (count == 0 || XEventsQueued(dpy, QueuedAlready) > 0)) {
+      XNextEvent(dpy, &batch[count]);
+      dropped[count] = false;
+      count++;
+    }
+    long long read_at = now_ns();
+    stats.event_batches++;
+    if ((unsigned long)count > stats.max_batch) {
+      stats.max_batch = count;
+    }
+    collapse_batch(batch, dropped, count);
+
+    in_batch = true;
+    for (int i = 0; i < count; i++) {
+      if (dropped[i] || !is_input_event(batch[i].type)) {
+        continue;
+      }
+      track_pointer(&batch[i]);
+      handle_event(dpy, root, &batch[i], &drag);
+
+      long long waited = now_ns() - read_at;
+      stats.input_events++;
+      stats.input_wait_ns += waited;
+      if (waited > stats.max_input_wait_ns) {
+        stats.max_input_wait_ns = waited;
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      if (dropped[i] || is_input_event(batch[i].type)) {
+        continue;
+      }
+      track_pointer(&batch[i]);
+      handle_event(dpy, root, &batch[i], &drag);
+    }
+    trace_batch_end(dpy);
+    finish_batch(dpy);
   }
 }
 
-static int error_occurred = 0;
+static __thread int error_occurred = 0;
 
 int handle_x_error(Display *dpy, XErrorEvent *error_event) {
   if (error_event->error_code == BadAccess) {
@@ -959,19 +5171,103 @@ int handle_x_error(Display *dpy, XErrorEvent *error_event) {
   return 0;
 }
 
-int main() {
+// Everything a display thread holds, before it ends with its server gone.
+// Its Display is left alone, Xlib is in the middle of failing on it
+void shutdown_display() {
+  // Nothing would ever continue them
+  thaw_all(false);
+  stop_worker();
+
+  if (inotify_fd >= 0) {
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  // Signal handlers read it, so it's gone from the table before it's closed
+  int wake_fd = display_wake_fds[display_index];
+  display_wake_fds[display_index] = -1;
+  if (wake_fd >= 0) {
+    close(wake_fd);
+  }
+
+  free_config(&config);
+  free(workspace_manager);
+  workspace_manager = NULL;
+  free(client_table);
+  client_table = NULL;
+  if (spawn_env) {
+    // Only the DISPLAY entry at the end is its own
+    int count = 0;
+    while (spawn_env[count]) {
+      count++;
+    }
+    free(spawn_env[count - 1]);
+    free(spawn_env);
+    spawn_env = NULL;
+  }
+}
+
+// A display going away only takes its own threads down. The first one ends
+// the process, as before, since the startup jobs belong to it
+int handle_x_io_error(Display *dpy) {
+  if (display_index < 0) {
+    pthread_exit(NULL); // A worker, its display thread cleans up
+  }
+  if (display_index == 0) {
+    thaw_all(true);
+    return 0; // Xlib exits
+  }
+  fprintf(stderr, "Lost connection to %s\n", DisplayString(dpy));
+  shutdown_display();
+  pthread_exit(NULL);
+}
+
+// environ with DISPLAY pointing at this thread's display, for what it runs
+char **display_environ(const char *name) {
+  int count = 0;
+  while (environ[count]) {
+    count++;
+  }
+
+  char **env = calloc(count + 2, sizeof(char *));
+  char *display = malloc(strlen("DISPLAY=") + strlen(name) + 1);
+  if (!env || !display) {
+    errx(1, "Couldn't allocate the environment for %s", name);
+  }
+  sprintf(display, "DISPLAY=%s", name);
+
+  int n = 0;
+  for (int i = 0; i < count; i++) {
+    if (strncmp(environ[i], "DISPLAY=", 8) != 0) {
+      env[n++] = environ[i];
+    }
+  }
+  env[n++] = display;
+  return env;
+}
+
+void manage_display(int index, const char *trace_path) {
   Display *dpy;
   int scr;
   Window root;
 
-  dpy = XOpenDisplay(NULL);
+  display_index = index;
+  display_names[index] = XDisplayName(display_names[index]);
+  // Only the first display is essential, the others just aren't managed
+  dpy = XOpenDisplay(display_names[index]);
+  if (dpy == NULL && index == 0) {
+    errx(1, "Couldn't open display %s", display_names[index]);
+  }
   if (dpy == NULL) {
-    errx(1, "Couldn't open display");
+    warnx("Couldn't open display %s, not managing it", display_names[index]);
+    return;
+  }
+  // Only the first display is recorded
+  if (trace_path && index == 0) {
+    trace_open(trace_path, dpy);
   }
 
   scr = DefaultScreen(dpy);
   root = RootWindow(dpy, scr);
-  XSetErrorHandler(handle_x_error);
   error_occurred = 0;
 
   XSelectInput(dpy, root,
@@ -981,27 +5277,47 @@ int main() {
 
   XSync(dpy, False);
 
+  if (error_occurred && index == 0) {
+    errx(1, "Another window manager is running on %s",
+         display_names[index]);
+  }
   if (error_occurred) {
-    errx(1, "Another window manager is running");
+    warnx("Another window manager is running on %s, not managing it",
+          display_names[index]);
+    XCloseDisplay(dpy);
+    return;
+  }
+  if (index > 0) {
+    spawn_env = display_environ(display_names[index]);
   }
 
-  printf("Opened display\n");
-
-  // Launch startup commands
-  system("/usr/bin/autostart.sh &");
-
-  init_layout();
+  printf("Opened display %s\n", display_names[index]);
+  display_wake_fds[index] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  clock_gettime(CLOCK_MONOTONIC, &stats.started);
+  stats.start_rss_kb = read_rss_kb();
 
   // EWMH
   init_ewmh(dpy, root);
 
   // Status bar
-  dock_geometry.x = 0;
-  dock_geometry.y = 0;
-  dock_geometry.width = 0;
-  dock_geometry.height = 0;
+  update_work_area(dpy);
+
+  // Config, every display reads and watches it on its own
+  if (load_config_file(&config, config_path)) {
+    printf("Loaded %s\n", config_path);
+  }
+  resolve_config_colors(dpy, &config);
+  watch_config_file();
+
+  // Launch startup jobs
+  if (index == 0) {
+    start_supervisor(&config);
+    start_pools(&config);
+  }
 
   init_workspace_manager();
+  init_clients();
+  start_worker(dpy);
   setup_keybindings(dpy, root);
   set_default_cursor(dpy, root);
 
@@ -1009,3 +5325,66 @@ int main() {
 
   XCloseDisplay(dpy);
 }
+
+void *display_main(void *arg) {
+  manage_display((intptr_t)arg, NULL);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  const char *trace_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+    switch (opt) {
+    case 't':
+      trace_path = optarg;
+      break;
+    case 'd':
+      if (num_displays == MAX_DISPLAYS) {
+        errx(1, "At most %d displays", MAX_DISPLAYS);
+      }
+      display_names[num_displays++] = optarg;
+      break;
+    default:
+      errx(1, "usage: %s [-t trace] [-d display]...", argv[0]);
+    }
+  }
+  // $DISPLAY when none are given
+  if (num_displays == 0) {
+    display_names[num_displays++] = NULL;
+  }
+  for (int i = 0; i < num_displays; i++) {
+    display_wake_fds[i] = -1;
+  }
+
+  // Worker threads and every display after the first have a connection of
+  // their own
+  XInitThreads();
+  XSetErrorHandler(handle_x_error);
+  XSetIOErrorHandler(handle_x_io_error);
+
+  // kill -USR1 dumps stats, -USR2 the clients. No SA_RESTART so they also
+  // wake up poll
+  struct sigaction sa = {.sa_handler = handle_sigusr1};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+  sa.sa_handler = handle_sigusr2;
+  sigaction(SIGUSR2, &sa, NULL);
+  sa.sa_handler = handle_sigterm;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  init_layout();
+  init_config_path();
+
+  for (int i = 1; i < num_displays; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, display_main, (void *)(intptr_t)i) !=
+        0) {
+      errx(1, "Couldn't start a thread for %s", display_names[i]);
+    }
+    pthread_detach(thread);
+  }
+  manage_display(0, trace_path);
+}
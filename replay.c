@@ -0,0 +1,689 @@
+#include <X11/XKBlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <err.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+// Replay
+// moody-replay is moody.c linked against this file instead of trace.c. Every
+// Xlib call moody makes is defined here, so no X server is needed: events and
+// replies come out of a trace recorded with moody -t, requests are counted and
+// dropped. At the end of the trace the time spent handling each event type is
+// printed to stderr
+
+static FILE *trace_file;
+static Display *replay_dpy;
+static Screen replay_screen;
+
+// The record at the head of the trace, read ahead so XPending and
+// XPeekEvent can look at it
+static TraceRecord record;
+static unsigned char *payload;
+static size_t payload_capacity;
+static int have_record;
+static int synthetic; // Replies are made up rather than read
+
+static unsigned long events_replayed, replies_replayed, replies_skipped,
+    replies_synthesized;
+static unsigned long requests, map_requests, configure_requests;
+
+// New windows mapped in the current batch, moody maps them at its end after
+// the handlers. A configure that reaches one after its map has it drawn twice
+#define MAX_NEW_WINDOWS 256
+static Window new_windows[MAX_NEW_WINDOWS];
+static int num_new_windows;
+static unsigned long new_windows_mapped, configures_after_map;
+
+// Handling time per event type
+typedef struct {
+  uint64_t *ns;
+  size_t count, capacity;
+} Latencies;
+
+static Latencies latencies[LASTEvent];
+static struct timespec event_started;
+static int event_type = -1;
+
+static const char *event_names[LASTEvent] = {
+    [KeyPress] = "KeyPress",
+    [KeyRelease] = "KeyRelease",
+    [ButtonPress] = "ButtonPress",
+    [ButtonRelease] = "ButtonRelease",
+    [MotionNotify] = "MotionNotify",
+    [EnterNotify] = "EnterNotify",
+    [LeaveNotify] = "LeaveNotify",
+    [FocusIn] = "FocusIn",
+    [FocusOut] = "FocusOut",
+    [Expose] = "Expose",
+    [CreateNotify] = "CreateNotify",
+    [DestroyNotify] = "DestroyNotify",
+    [UnmapNotify] = "UnmapNotify",
+    [MapNotify] = "MapNotify",
+    [MapRequest] = "MapRequest",
+    [ConfigureNotify] = "ConfigureNotify",
+    [ConfigureRequest] = "ConfigureRequest",
+    [PropertyNotify] = "PropertyNotify",
+    [ClientMessage] = "ClientMessage",
+};
+
+static uint64_t elapsed_ns(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec -
+         start->tv_nsec;
+}
+
+static void start_event(int type) {
+  event_type = type < LASTEvent ? type : 0;
+  clock_gettime(CLOCK_MONOTONIC, &event_started);
+}
+
+static void finish_event() {
+  if (event_type < 0) {
+    return;
+  }
+
+  Latencies *l = &latencies[event_type];
+  if (l->count == l->capacity) {
+    l->capacity = l->capacity ? l->capacity * 2 : 64;
+    l->ns = realloc(l->ns, l->capacity * sizeof(*l->ns));
+    if (!l->ns) {
+      err(1, "realloc");
+    }
+  }
+  l->ns[l->count++] = elapsed_ns(&event_started);
+  event_type = -1;
+}
+
+static int compare_ns(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_report() {
+  fprintf(stderr,
+          "Replayed %lu events, %lu replies (%lu skipped, %lu made up)\n",
+          events_replayed, replies_replayed, replies_skipped,
+          replies_synthesized);
+  fprintf(stderr, "Requests: %lu (%lu maps, %lu configures)\n", requests,
+          map_requests, configure_requests);
+  fprintf(stderr, "New windows: %lu, configured after the map: %lu\n",
+          new_windows_mapped, configures_after_map);
+  fprintf(stderr, "%-18s %8s %10s %10s %10s %10s\n", "event", "count",
+          "mean us", "p50 us", "p99 us", "max us");
+
+  // The last row is every event together
+  Latencies all = {0};
+  for (int type = 0; type <= LASTEvent; type++) {
+    Latencies *l = type < LASTEvent ? &latencies[type] : &all;
+    if (!l->count) {
+      continue;
+    }
+    if (type < LASTEvent) {
+      all.ns = realloc(all.ns, (all.count + l->count) * sizeof(*all.ns));
+      if (!all.ns) {
+        err(1, "realloc");
+      }
+      memcpy(all.ns + all.count, l->ns, l->count * sizeof(*l->ns));
+      all.count += l->count;
+    }
+
+    qsort(l->ns, l->count, sizeof(*l->ns), compare_ns);
+    uint64_t total = 0;
+    for (size_t i = 0; i < l->count; i++) {
+      total += l->ns[i];
+    }
+    fprintf(stderr, "%-18s %8zu %10.2f %10.2f %10.2f %10.2f\n",
+            type == LASTEvent      ? "all"
+            : event_names[type] ? event_names[type]
+                                : "other",
+            l->count, total / 1000.0 / l->count, l->ns[l->count / 2] / 1000.0,
+            l->ns[l->count * 99 / 100] / 1000.0, l->ns[l->count - 1] / 1000.0);
+  }
+}
+
+// Trace reading
+
+static int peek_record() {
+  if (have_record) {
+    return 1;
+  }
+  if (!trace_file) {
+    errx(1, "usage: moody-replay -t trace");
+  }
+  if (fread(&record, sizeof(record), 1, trace_file) != 1) {
+    return 0;
+  }
+
+  if (record.size > payload_capacity) {
+    payload_capacity = record.size;
+    payload = realloc(payload, payload_capacity);
+    if (!payload) {
+      err(1, "realloc");
+    }
+  }
+  if (fread(payload, 1, record.size, trace_file) != record.size) {
+    errx(1, "Trace is truncated");
+  }
+  have_record = 1;
+  return 1;
+}
+
+// Whatever moody did with the trace so far, it has to ask for the same
+// replies in the same order, anything else means the replay went its own way.
+// Synthetic traces (moody-synth) have no replies at all, NULL tells the
+// caller to make one up
+static const unsigned char *take_reply(uint8_t call, size_t size) {
+  if (synthetic) {
+    replies_synthesized++;
+    return NULL;
+  }
+  if (!peek_record()) {
+    errx(2, "Replay diverged after %lu events: moody asked for call %d, "
+            "trace has ended",
+         events_replayed, call);
+  }
+  if (record.kind != TRACE_REPLY) {
+    errx(2, "Replay diverged after %lu events: moody asked for call %d, "
+            "trace has record kind %d",
+         events_replayed, call, record.kind);
+  }
+  if (record.size < 1 || payload[0] != call) {
+    errx(2, "Replay diverged after %lu events: moody asked for call %d, "
+            "trace has call %d",
+         events_replayed, call, record.size ? payload[0] : 0);
+  }
+  if (record.size - 1 < size) {
+    errx(1, "Reply for call %d is too short", call);
+  }
+
+  have_record = 0;
+  replies_replayed++;
+  return payload + 1;
+}
+
+// Worker results are applied between events, as they were when recording.
+// Replies outside of any event (a config reload) didn't happen this time and
+// are skipped
+static int next_event_queued() {
+  while (peek_record()) {
+    if (record.kind == TRACE_EVENT) {
+      return 1;
+    }
+    if (record.kind == TRACE_DETAILS) {
+      have_record = 0;
+      apply_client_details(replay_dpy, (struct ClientDetails *)payload);
+    } else if (record.kind == TRACE_BATCH) {
+      have_record = 0;
+    } else {
+      have_record = 0;
+      replies_skipped++;
+    }
+  }
+  return 0;
+}
+
+static void read_event(XEvent *ev, int consume) {
+  if (!next_event_queued()) {
+    errx(2, "Replay diverged: moody read past the end of the trace");
+  }
+
+  memset(ev, 0, sizeof(*ev));
+  memcpy(ev, payload, record.size < sizeof(*ev) ? record.size : sizeof(*ev));
+  ev->xany.display = replay_dpy;
+  if (consume) {
+    have_record = 0;
+    events_replayed++;
+  }
+}
+
+void trace_open(const char *path, Display *dpy) {
+  trace_file = fopen(path, "rb");
+  if (!trace_file) {
+    err(1, "%s", path);
+  }
+
+  TraceHeader header;
+  if (fread(&header, sizeof(header), 1, trace_file) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+    errx(1, "%s isn't a moody trace", path);
+  }
+  replay_screen.width = header.screen_width;
+  replay_screen.height = header.screen_height;
+  replay_screen.root = header.root;
+  synthetic = header.flags & TRACE_SYNTHETIC;
+}
+
+void trace_flush() {}
+
+void trace_client_details(Display *dpy, const struct ClientDetails *details,
+                          size_t size) {}
+
+void trace_event_start(int type) {
+  finish_event();
+  start_event(type);
+}
+
+void trace_batch_end(Display *dpy) { finish_event(); }
+
+// Anything moody runs would talk to a real server, so startup jobs, pool
+// instances and launches get made up pids that never exit
+int posix_spawn(pid_t *pid, const char *path,
+                const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attr, char *const argv[],
+                char *const envp[]) {
+  static pid_t next_pid = 1 << 22;
+  *pid = next_pid++;
+  return 0;
+}
+
+// Those pids belong to someone else, or no one
+int kill(pid_t pid, int sig) { return 0; }
+
+// Connection
+
+Status XInitThreads() { return 1; }
+
+Display *XOpenDisplay(const char *name) {
+  // The worker's connection fails, its results are in the trace
+  if (replay_dpy) {
+    return NULL;
+  }
+
+  _XPrivDisplay dpy = calloc(1, sizeof(*dpy));
+  if (!dpy) {
+    return NULL;
+  }
+  dpy->fd = -1;
+  dpy->display_name = "replay";
+  dpy->nscreens = 1;
+  dpy->screens = &replay_screen;
+  replay_screen.display = (Display *)dpy;
+  replay_screen.width = 1920;
+  replay_screen.height = 1080;
+  replay_screen.root = 1;
+  replay_screen.root_depth = 24;
+  replay_screen.white_pixel = 0xffffff;
+
+  replay_dpy = (Display *)dpy;
+  return replay_dpy;
+}
+
+int XCloseDisplay(Display *dpy) { return 0; }
+
+XErrorHandler XSetErrorHandler(XErrorHandler handler) { return NULL; }
+
+int XSync(Display *dpy, Bool discard) { return 1; }
+
+int XFlush(Display *dpy) { return 1; }
+
+int XDisplayWidth(Display *dpy, int screen) { return replay_screen.width; }
+
+int XDisplayHeight(Display *dpy, int screen) { return replay_screen.height; }
+
+int XFree(void *data) {
+  free(data);
+  return 1;
+}
+
+// Events
+
+// Reaching the end of the trace ends the replay
+int XPending(Display *dpy) {
+  finish_event();
+  num_new_windows = 0;
+  if (!next_event_queued()) {
+    print_report();
+    exit(0);
+  }
+  return 1;
+}
+
+// A batch ends where the recording's did, at a batch marker, or at replies
+// and worker results that came in after it. Synthetic traces have neither,
+// their batches are as long as moody takes them
+int XEventsQueued(Display *dpy, int mode) {
+  return peek_record() && record.kind == TRACE_EVENT;
+}
+
+int XNextEvent(Display *dpy, XEvent *ev) {
+  read_event(ev, 1);
+  return 0;
+}
+
+int XPeekEvent(Display *dpy, XEvent *ev) {
+  read_event(ev, 0);
+  return 1;
+}
+
+// Calls with replies
+
+// Made up replies: every atom name gets its own id, keycodes are the low byte
+// of the keysym (what moody-synth sends), nothing has properties or hints
+#define MAX_SYNTHETIC_ATOMS 256
+static char *atom_names[MAX_SYNTHETIC_ATOMS];
+static int num_atoms;
+static KeySym keysyms[256];
+
+static Atom synthetic_atom(const char *name) {
+  for (int i = 0; i < num_atoms; i++) {
+    if (strcmp(atom_names[i], name) == 0) {
+      return XA_LAST_PREDEFINED + 1 + i;
+    }
+  }
+  if (num_atoms == MAX_SYNTHETIC_ATOMS) {
+    errx(1, "Too many atoms");
+  }
+  atom_names[num_atoms] = strdup(name);
+  return XA_LAST_PREDEFINED + 1 + num_atoms++;
+}
+
+Atom XInternAtom(Display *dpy, const char *name, Bool only_if_exists) {
+  const unsigned char *data = take_reply(TRACE_INTERN_ATOM, sizeof(uint64_t));
+  if (!data) {
+    return synthetic_atom(name);
+  }
+
+  uint64_t atom;
+  memcpy(&atom, data, sizeof(atom));
+  return atom;
+}
+
+int XGetWindowProperty(Display *dpy, Window win, Atom property, long offset,
+                       long length, Bool delete, Atom req_type,
+                       Atom *actual_type, int *actual_format,
+                       unsigned long *nitems, unsigned long *bytes_after,
+                       unsigned char **prop) {
+  TracePropertyReply reply = {.status = Success};
+  const unsigned char *data =
+      take_reply(TRACE_GET_WINDOW_PROPERTY, sizeof(reply));
+  if (data) {
+    memcpy(&reply, data, sizeof(reply));
+  }
+  if (reply.status != Success) {
+    return reply.status;
+  }
+
+  *actual_type = reply.actual_type;
+  *actual_format = reply.actual_format;
+  *nitems = reply.nitems;
+  *bytes_after = reply.bytes_after;
+
+  // Like Xlib, a spare zero byte after the data
+  size_t size = data ? record.size - 1 - sizeof(reply) : 0;
+  *prop = NULL;
+  if (size) {
+    *prop = calloc(1, size + 1);
+    memcpy(*prop, data + sizeof(reply), size);
+  }
+  return Success;
+}
+
+Status XGetTransientForHint(Display *dpy, Window win, Window *transient_for) {
+  uint64_t reply[2] = {0};
+  const unsigned char *data =
+      take_reply(TRACE_GET_TRANSIENT_FOR_HINT, sizeof(reply));
+  if (data) {
+    memcpy(reply, data, sizeof(reply));
+  }
+  if (reply[0]) {
+    *transient_for = reply[1];
+  }
+  return reply[0];
+}
+
+Status XGetWMNormalHints(Display *dpy, Window win, XSizeHints *hints,
+                         long *supplied) {
+  struct {
+    int32_t status;
+    XSizeHints hints;
+    long supplied;
+  } reply = {0};
+  const unsigned char *data =
+      take_reply(TRACE_GET_WM_NORMAL_HINTS, sizeof(reply));
+  if (data) {
+    memcpy(&reply, data, sizeof(reply));
+  }
+  if (reply.status) {
+    *hints = reply.hints;
+    *supplied = reply.supplied;
+  }
+  return reply.status;
+}
+
+Status XGetWindowAttributes(Display *dpy, Window win,
+                            XWindowAttributes *attr) {
+  struct {
+    int32_t status;
+    XWindowAttributes attr;
+  } reply = {.status = 1,
+             .attr = {.width = 640, .height = 480, .map_state = IsViewable}};
+  const unsigned char *data =
+      take_reply(TRACE_GET_WINDOW_ATTRIBUTES, sizeof(reply));
+  if (data) {
+    memcpy(&reply, data, sizeof(reply));
+  }
+  if (reply.status) {
+    *attr = reply.attr;
+    attr->screen = &replay_screen;
+  }
+  return reply.status;
+}
+
+Status XAllocColor(Display *dpy, Colormap cmap, XColor *color) {
+  struct {
+    int32_t status;
+    XColor color;
+  } reply;
+  const unsigned char *data = take_reply(TRACE_ALLOC_COLOR, sizeof(reply));
+  if (!data) {
+    color->pixel =
+        (color->red >> 8) << 16 | (color->green >> 8) << 8 | color->blue >> 8;
+    return 1;
+  }
+
+  memcpy(&reply, data, sizeof(reply));
+  *color = reply.color;
+  return reply.status;
+}
+
+KeyCode XKeysymToKeycode(Display *dpy, KeySym keysym) {
+  const unsigned char *data =
+      take_reply(TRACE_KEYSYM_TO_KEYCODE, sizeof(KeyCode));
+  if (!data) {
+    keysyms[keysym & 0xff] = keysym;
+    return keysym & 0xff;
+  }
+
+  KeyCode keycode;
+  memcpy(&keycode, data, sizeof(keycode));
+  return keycode;
+}
+
+KeySym XkbKeycodeToKeysym(Display *dpy,
+#if NeedWidePrototypes
+                          unsigned int keycode,
+#else
+                          KeyCode keycode,
+#endif
+                          int group, int level) {
+  const unsigned char *data =
+      take_reply(TRACE_KEYCODE_TO_KEYSYM, sizeof(uint64_t));
+  if (!data) {
+    return keysyms[keycode & 0xff];
+  }
+
+  uint64_t keysym;
+  memcpy(&keysym, data, sizeof(keysym));
+  return keysym;
+}
+
+// Only the worker asks for these, and it isn't running
+Status XGetTextProperty(Display *dpy, Window win, XTextProperty *text,
+                        Atom property) {
+  return 0;
+}
+
+Status XGetClassHint(Display *dpy, Window win, XClassHint *class_hint) {
+  return 0;
+}
+
+// Requests, counted and dropped
+
+static Window next_window_id = 0x100000;
+
+Window XCreateSimpleWindow(Display *dpy, Window parent, int x, int y,
+                           unsigned int width, unsigned int height,
+                           unsigned int border_width, unsigned long border,
+                           unsigned long background) {
+  requests++;
+  return next_window_id++;
+}
+
+Cursor XCreateFontCursor(Display *dpy, unsigned int shape) {
+  requests++;
+  return next_window_id++;
+}
+
+static void count_configure(Window win) {
+  requests++;
+  configure_requests++;
+  for (int i = 0; i < num_new_windows; i++) {
+    if (new_windows[i] == win) {
+      configures_after_map++;
+    }
+  }
+}
+
+int XMapWindow(Display *dpy, Window win) {
+  requests++;
+  map_requests++;
+  if ((event_type < 0 || event_type == MapRequest) &&
+      num_new_windows < MAX_NEW_WINDOWS) {
+    new_windows[num_new_windows++] = win;
+    new_windows_mapped++;
+  }
+  return 1;
+}
+
+int XUnmapWindow(Display *dpy, Window win) {
+  requests++;
+  return 1;
+}
+
+int XMoveWindow(Display *dpy, Window win, int x, int y) {
+  count_configure(win);
+  return 1;
+}
+
+int XMoveResizeWindow(Display *dpy, Window win, int x, int y,
+                      unsigned int width, unsigned int height) {
+  count_configure(win);
+  return 1;
+}
+
+int XConfigureWindow(Display *dpy, Window win, unsigned int mask,
+                     XWindowChanges *changes) {
+  count_configure(win);
+  return 1;
+}
+
+int XRaiseWindow(Display *dpy, Window win) {
+  count_configure(win);
+  return 1;
+}
+
+int XSetWindowBorderWidth(Display *dpy, Window win, unsigned int width) {
+  count_configure(win);
+  return 1;
+}
+
+int XSetWindowBorder(Display *dpy, Window win, unsigned long pixel) {
+  requests++;
+  return 1;
+}
+
+int XClearWindow(Display *dpy, Window win) {
+  requests++;
+  return 1;
+}
+
+int XSelectInput(Display *dpy, Window win, long mask) {
+  requests++;
+  return 1;
+}
+
+int XDefineCursor(Display *dpy, Window win, Cursor cursor) {
+  requests++;
+  return 1;
+}
+
+int XChangeProperty(Display *dpy, Window win, Atom property, Atom type,
+                    int format, int mode, const unsigned char *data,
+                    int nelements) {
+  requests++;
+  return 1;
+}
+
+Status XSendEvent(Display *dpy, Window win, Bool propagate, long mask,
+                  XEvent *ev) {
+  requests++;
+  return 1;
+}
+
+int XSetInputFocus(Display *dpy, Window focus, int revert_to, Time time) {
+  requests++;
+  return 1;
+}
+
+int XFreeColors(Display *dpy, Colormap cmap, unsigned long *pixels,
+                int npixels, unsigned long planes) {
+  requests++;
+  return 1;
+}
+
+int XGrabKey(Display *dpy, int keycode, unsigned int modifiers, Window win,
+             Bool owner_events, int pointer_mode, int keyboard_mode) {
+  requests++;
+  return 1;
+}
+
+int XUngrabKey(Display *dpy, int keycode, unsigned int modifiers,
+               Window win) {
+  requests++;
+  return 1;
+}
+
+int XGrabButton(Display *dpy, unsigned int button, unsigned int modifiers,
+                Window win, Bool owner_events, unsigned int mask,
+                int pointer_mode, int keyboard_mode, Window confine_to,
+                Cursor cursor) {
+  requests++;
+  return 1;
+}
+
+int XUngrabButton(Display *dpy, unsigned int button, unsigned int modifiers,
+                  Window win) {
+  requests++;
+  return 1;
+}
+
+int XChangeActivePointerGrab(Display *dpy, unsigned int mask, Cursor cursor,
+                             Time time) {
+  requests++;
+  return 1;
+}
+
+int XUngrabPointer(Display *dpy, Time time) {
+  requests++;
+  return 1;
+}
@@ -0,0 +1,357 @@
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xlibint.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XResproto.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Soak clients
+// Throws random clients at the window manager on $DISPLAY for a while, for
+// make soak (see soak.sh). Every client is a connection of its own that maps
+// a few windows, some of them transient dialogs, spams configure requests,
+// title and size hint changes, goes fullscreen and back, withdraws and destroys windows and
+// eventually disconnects with whatever it has left. Every few seconds it
+// prints the throughput and how many X resources the window manager holds
+// (X-Resource extension). Once every client is gone that has to be back to
+// what it was before the first one, or it exits with 1
+
+#define MAX_SOAK_CLIENTS 48 // Connected at once, well under the server's limit
+#define MAX_CLIENT_WINDOWS 4
+#define MAX_RESOURCE_TYPES 32
+
+typedef struct {
+  Display *dpy;
+  Window windows[MAX_CLIENT_WINDOWS];
+  int mapped[MAX_CLIENT_WINDOWS];
+  int fullscreen[MAX_CLIENT_WINDOWS];
+  int num_windows;
+} SoakClient;
+
+typedef struct {
+  Atom type;
+  long count;
+} ResourceCount;
+
+static SoakClient clients[MAX_SOAK_CLIENTS];
+static int num_clients;
+static unsigned long clients_started, windows_created, steps_taken;
+
+static long long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Window manager resources
+
+static Window wm_check_window(Display *dpy) {
+  Atom check = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char *prop = NULL;
+  Window window = None;
+
+  if (XGetWindowProperty(dpy, DefaultRootWindow(dpy), check, 0, 1, False,
+                         XA_WINDOW, &actual_type, &actual_format, &nitems,
+                         &bytes_after, &prop) == Success &&
+      prop) {
+    if (actual_format == 32 && nitems == 1) {
+      window = *(Window *)prop;
+    }
+    XFree(prop);
+  }
+  return window;
+}
+
+// The X resources of the window manager's connection by type, -1 if the
+// server has no X-Resource extension. Any XID of a client names the client,
+// the window manager's _NET_SUPPORTING_WM_CHECK window is one. libXRes isn't
+// needed for a single request
+static int wm_resources(Display *dpy, ResourceCount *counts) {
+  int opcode, first_event, first_error;
+  Window check = wm_check_window(dpy);
+  if (check == None ||
+      !XQueryExtension(dpy, XRES_NAME, &opcode, &first_event, &first_error)) {
+    return -1;
+  }
+
+  xXResQueryClientResourcesReq *req;
+  xXResQueryClientResourcesReply reply;
+  LockDisplay(dpy);
+  GetReq(XResQueryClientResources, req);
+  req->reqType = opcode;
+  req->XResReqType = X_XResQueryClientResources;
+  req->xid = check;
+  if (!_XReply(dpy, (xReply *)&reply, 0, xFalse)) {
+    UnlockDisplay(dpy);
+    SyncHandle();
+    return -1;
+  }
+
+  int num_types = 0;
+  for (CARD32 i = 0; i < reply.num_types; i++) {
+    xXResType type;
+    _XRead(dpy, (char *)&type, sz_xXResType);
+    if (num_types < MAX_RESOURCE_TYPES) {
+      counts[num_types].type = type.resource_type;
+      counts[num_types].count = type.count;
+      num_types++;
+    }
+  }
+  UnlockDisplay(dpy);
+  SyncHandle();
+  return num_types;
+}
+
+static long total_resources(ResourceCount *counts, int num_types) {
+  long total = 0;
+  for (int i = 0; i < num_types; i++) {
+    total += counts[i].count;
+  }
+  return total;
+}
+
+// Prints every type there's more of than at the start, returns how many
+static int report_growth(Display *dpy, ResourceCount *before,
+                         int num_before, ResourceCount *after,
+                         int num_after) {
+  int grown = 0;
+  for (int i = 0; i < num_after; i++) {
+    long was = 0;
+    for (int j = 0; j < num_before; j++) {
+      if (before[j].type == after[i].type) {
+        was = before[j].count;
+      }
+    }
+    if (after[i].count > was) {
+      char *name = XGetAtomName(dpy, after[i].type);
+      printf("  %s: %ld -> %ld\n", name ? name : "?", was, after[i].count);
+      XFree(name);
+      grown++;
+    }
+  }
+  return grown;
+}
+
+// Clients
+
+static int x_error(Display *dpy, XErrorEvent *ev) {
+  // Windows the window manager or a disconnect already took away
+  return 0;
+}
+
+static void open_client() {
+  Display *dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    warnx("Couldn't open a client connection");
+    return;
+  }
+  clients[num_clients++] = (SoakClient){.dpy = dpy};
+  clients_started++;
+}
+
+static void close_client(int c) {
+  // The server destroys whatever windows it still has
+  XCloseDisplay(clients[c].dpy);
+  clients[c] = clients[--num_clients];
+}
+
+static void send_fullscreen(SoakClient *client, int i) {
+  Display *dpy = client->dpy;
+  client->fullscreen[i] = !client->fullscreen[i];
+
+  XEvent ev = {0};
+  ev.xclient.type = ClientMessage;
+  ev.xclient.window = client->windows[i];
+  ev.xclient.message_type = XInternAtom(dpy, "_NET_WM_STATE", False);
+  ev.xclient.format = 32;
+  ev.xclient.data.l[0] = client->fullscreen[i];
+  ev.xclient.data.l[1] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
+  XSendEvent(dpy, DefaultRootWindow(dpy), False,
+             SubstructureRedirectMask | SubstructureNotifyMask, &ev);
+}
+
+static void new_window(SoakClient *client) {
+  if (client->num_windows == MAX_CLIENT_WINDOWS) {
+    return;
+  }
+  Display *dpy = client->dpy;
+  Window window = XCreateSimpleWindow(
+      dpy, DefaultRootWindow(dpy), rand() % 1600, rand() % 900,
+      100 + rand() % 700, 100 + rand() % 500, 0, 0, 0);
+
+  XClassHint class_hint = {.res_name = "soak", .res_class = "Soak"};
+  XSetClassHint(dpy, window, &class_hint);
+  XStoreName(dpy, window, "soak");
+  long pid = getpid();
+  XChangeProperty(dpy, window, XInternAtom(dpy, "_NET_WM_PID", False),
+                  XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&pid, 1);
+  // A dialog for one of its windows now and then
+  if (client->num_windows > 0 && rand() % 4 == 0) {
+    XSetTransientForHint(dpy, window, client->windows[0]);
+  }
+  XMapWindow(dpy, window);
+
+  int i = client->num_windows++;
+  client->windows[i] = window;
+  client->mapped[i] = 1;
+  client->fullscreen[i] = 0;
+  windows_created++;
+}
+
+static void destroy_window(SoakClient *client, int i) {
+  XDestroyWindow(client->dpy, client->windows[i]);
+  int last = --client->num_windows;
+  client->windows[i] = client->windows[last];
+  client->mapped[i] = client->mapped[last];
+  client->fullscreen[i] = client->fullscreen[last];
+}
+
+// One random thing a random client does
+static void step() {
+  if (num_clients == 0 ||
+      (num_clients < MAX_SOAK_CLIENTS && rand() % 8 == 0)) {
+    open_client();
+    return;
+  }
+
+  int c = rand() % num_clients;
+  SoakClient *client = &clients[c];
+  int i = client->num_windows ? rand() % client->num_windows : -1;
+  int action = i < 0 ? 0 : rand() % 16;
+
+  if (action < 4) {
+    new_window(client);
+  } else if (action < 6) {
+    // Configure spam
+    for (int n = 0; n < 50; n++) {
+      XMoveResizeWindow(client->dpy, client->windows[i], rand() % 1600,
+                        rand() % 900, 50 + rand() % 900, 50 + rand() % 700);
+    }
+  } else if (action < 8) {
+    char title[32];
+    for (int n = 0; n < 20; n++) {
+      snprintf(title, sizeof(title), "soak %d", rand());
+      XStoreName(client->dpy, client->windows[i], title);
+    }
+    // New size hints now and then, a terminal does that on a font change
+    if (rand() % 4 == 0) {
+      XSizeHints hints = {.flags = PMinSize | PResizeInc,
+                          .min_width = 50 + rand() % 200,
+                          .min_height = 50 + rand() % 200,
+                          .width_inc = 1 + rand() % 10,
+                          .height_inc = 1 + rand() % 20};
+      XSetWMNormalHints(client->dpy, client->windows[i], &hints);
+    }
+  } else if (action < 9) {
+    send_fullscreen(client, i);
+  } else if (action < 11) {
+    // Withdraw, or map again
+    if (client->mapped[i]) {
+      XWithdrawWindow(client->dpy, client->windows[i],
+                      DefaultScreen(client->dpy));
+    } else {
+      XMapWindow(client->dpy, client->windows[i]);
+    }
+    client->mapped[i] = !client->mapped[i];
+  } else if (action < 15) {
+    destroy_window(client, i);
+  } else {
+    close_client(c);
+    steps_taken++;
+    return;
+  }
+  XFlush(client->dpy);
+  steps_taken++;
+
+  // Nothing is selected, but errors and client messages still come in
+  while (XPending(client->dpy)) {
+    XEvent ev;
+    XNextEvent(client->dpy, &ev);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int seconds = 600, report_every = 10, rate = 200;
+  unsigned int seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:i:r:s:")) != -1) {
+    switch (opt) {
+    case 't':
+      seconds = atoi(optarg);
+      break;
+    case 'i':
+      report_every = atoi(optarg);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      errx(2, "usage: %s [-t seconds] [-i report seconds] [-r steps/s] "
+              "[-s seed]",
+           argv[0]);
+    }
+  }
+  srand(seed);
+  XSetErrorHandler(x_error);
+
+  Display *dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    errx(2, "Couldn't open display");
+  }
+  ResourceCount before[MAX_RESOURCE_TYPES], after[MAX_RESOURCE_TYPES];
+  int num_before = wm_resources(dpy, before);
+  if (num_before < 0) {
+    errx(2, "No window manager, or no X-Resource extension");
+  }
+  printf("Window manager holds %ld X resources\n",
+         total_resources(before, num_before));
+
+  long long start = now_ms(), next_report = start + report_every * 1000LL;
+  long long end = start + seconds * 1000LL;
+  for (long long now = start; now < end; now = now_ms()) {
+    step();
+    if (now >= next_report) {
+      int num_types = wm_resources(dpy, after);
+      double elapsed = (now - start) / 1000.0;
+      printf("%.0f s: %lu clients (%d now), %lu windows, %.0f steps/s, "
+             "window manager holds %ld X resources\n",
+             elapsed, clients_started, num_clients, windows_created,
+             steps_taken / elapsed, total_resources(after, num_types));
+      fflush(stdout);
+      next_report += report_every * 1000LL;
+    }
+    usleep(1000000 / rate);
+  }
+
+  // Everyone leaves, then the window manager should have let go of it all
+  while (num_clients > 0) {
+    close_client(num_clients - 1);
+  }
+  sleep(2);
+  int num_after = wm_resources(dpy, after);
+  if (num_after < 0) {
+    printf("The window manager is gone\n");
+    return 1;
+  }
+  printf("Done: %lu clients, %lu windows. Window manager holds %ld X "
+         "resources, %ld at the start\n",
+         clients_started, windows_created, total_resources(after, num_after),
+         total_resources(before, num_before));
+  if (report_growth(dpy, before, num_before, after, num_after) > 0) {
+    printf("X resources leaked\n");
+    return 1;
+  }
+  XCloseDisplay(dpy);
+  return 0;
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Soak test (make soak). Runs the debug build of moody on a fresh Xvfb with
+# moody-soak throwing random clients at it for $1 seconds (600 by default),
+# asks for stats every $2 seconds (30) and fails if moody died, broke an
+# invariant or held on to X resources once every client was gone. moody's
+# output goes to soak.log
+
+SOAK_SECONDS=${1:-600}
+STATS_EVERY=${2:-30}
+SOAK_DISPLAY=${SOAK_DISPLAY:-:99}
+LOG=soak.log
+
+if ! command -v Xvfb > /dev/null; then
+  echo "make soak needs Xvfb"
+  exit 2
+fi
+
+Xvfb "$SOAK_DISPLAY" -screen 0 1920x1080x24 -nolisten tcp &
+xvfb=$!
+trap 'kill $moody $xvfb 2>/dev/null' EXIT
+sleep 1
+
+# The defaults from config.h, not your moodyrc
+DISPLAY=$SOAK_DISPLAY XDG_CONFIG_HOME=/nonexistent ./moody-debug > $LOG 2>&1 &
+moody=$!
+sleep 1
+
+DISPLAY=$SOAK_DISPLAY ./moody-soak -t "$SOAK_SECONDS" &
+soak=$!
+elapsed=0
+while kill -0 $soak 2>/dev/null; do
+  sleep 1
+  elapsed=$((elapsed + 1))
+  if [ $((elapsed % STATS_EVERY)) -eq 0 ]; then
+    kill -USR1 $moody 2>/dev/null
+  fi
+done
+wait $soak
+status=$?
+
+kill -USR1 $moody 2>/dev/null
+sleep 1
+if ! kill -0 $moody 2>/dev/null; then
+  echo "moody died, see $LOG"
+  grep "Round trip" $LOG
+  status=1
+fi
+if grep -q "Invariant violated" $LOG; then
+  grep "Invariant violated" $LOG | sort | uniq -c
+  status=1
+fi
+
+# RSS at the first and the last stats
+grep "^  rss:" $LOG | sed -n '1p;$p'
+
+if [ $status -eq 0 ]; then
+  echo "Soak passed"
+else
+  echo "Soak failed"
+fi
+exit $status
@@ -1,3 +1,10 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
 #include "config.h"
 
 typedef struct {
@@ -8,18 +15,106 @@ typedef struct {
   int is_resizing;
 } DragState;
 
+// WM_NORMAL_HINTS, 0 where the client doesn't care
+typedef struct {
+  int base_width, base_height;
+  int inc_width, inc_height;
+  int min_width, min_height;
+  int max_width, max_height;
+  float min_aspect, max_aspect;
+} SizeHints;
+
+// What the worker is asked to read
+#define FETCH_DETAILS 0    // Name, class and process of a new window
+#define FETCH_SIZE_HINTS 1 // WM_NORMAL_HINTS changed
+#define FETCH_STRUT 2      // A dock's strut changed
+
+// What the worker finds out about a client in the background
+typedef struct ClientDetails {
+  Window window;
+  int fetch; // FETCH_*, the rest is only what that one reads
+  pid_t pid;         // _NET_WM_PID, 0 if unknown
+  char name[128];    // _NET_WM_NAME or WM_NAME
+  char wm_class[64]; // Class part of WM_CLASS
+  char machine[64];  // WM_CLIENT_MACHINE
+  char command[32];  // /proc/<pid>/comm, only for local clients
+  SizeHints hints;   // FETCH_SIZE_HINTS
+  long strut[4];     // FETCH_STRUT
+} ClientDetails;
+
+// What a client asked of moody
+typedef struct {
+  unsigned long configure_requests, map_requests, property_changes;
+} ClientActivity;
+
 typedef struct {
   Window window;
   int x, y;
   int width, height;
   int border_width;
   int is_floating;
+  int is_fullscreen;
+  int is_hidden; // On a workspace that isn't shown
+  int is_parked; // Hidden by moving it offscreen rather than unmapping it
+  int expected_unmaps; // Unmaps moody did itself whose UnmapNotify is due
+  // Geometry the server has, as far as moody knows, so tiles that already
+  // have their place aren't configured again. Width 0 when unknown
+  int server_x, server_y, server_width, server_height;
+  int skip_configure; // Ignore its configure requests
+  int has_details;
+  ClientDetails details;
+  SizeHints hints;
+  long long configure_period_start; // For the configure rate limit
+  int configure_period_count;
+  int focus_node; // Its node in the workspace's FocusHistory
+  long long hidden_cpu_ticks; // Its process's CPU time once its workspace
+                              // was hidden, -1 if not read
+  long long hidden_group_ticks; // The same for the process group it leads,
+                                // -1 if it doesn't lead one
+  // Its activity until the worker says whose it is, then the client's record
+  // gets it
+  ClientActivity activity;
 } WindowInfo;
 
+// Focus history of a workspace, most recently focused first. A list linked
+// through a fixed pool of nodes so focusing, removing and finding the window
+// to fall back to are all constant time
+typedef struct {
+  Window window;
+  int prev, next; // Indices into FocusHistory.nodes, -1 at the ends
+} FocusNode;
+
+typedef struct {
+  FocusNode nodes[MAX_WINDOWS];
+  int head, tail;
+  int free; // Unused nodes, chained through next
+} FocusHistory;
+
+// Which windows of a workspace overlap each cell of a grid over the screen,
+// one bit per index into its windows. Rebuilt by the first lookup after
+// anything moved
+#define INDEX_WORDS ((MAX_WINDOWS + 63) / 64)
+
+typedef struct {
+  uint64_t cells[INDEX_ROWS][INDEX_COLS][INDEX_WORDS];
+  int cell_width, cell_height;
+  bool dirty;
+} SpatialIndex;
+
 typedef struct {
   WindowInfo windows[MAX_WINDOWS];
   int count;
   Window master; // Store the master window
+  FocusHistory history;
+  int mode;          // LAYOUT_*
+  int focus_index;   // Where focused_window was last seen in windows, -1 if
+                     // not here, so cycling doesn't have to search
+  int monocle_index; // The tile shown in monocle mode, -1 for none
+  SpatialIndex index;
+  // For freezing: when it was hidden (0 while shown), when its processes'
+  // CPU time was read after that (0 before), and whether they're stopped
+  long long hidden_since, sampled_at;
+  bool frozen;
 } TilingLayout;
 
 typedef struct {
@@ -27,7 +122,204 @@ typedef struct {
   int current_workspace;
 } WorkspaceManager;
 
+// Indices into Dock.strut, same order as _NET_WM_STRUT
+#define STRUT_LEFT 0
+#define STRUT_RIGHT 1
+#define STRUT_TOP 2
+#define STRUT_BOTTOM 3
+
+typedef struct {
+  Window window;
+  long strut[4]; // Space reserved at each screen edge
+} Dock;
+
+// The part of the screen not reserved by docks
 typedef struct {
   int x, y;
-  unsigned int width, height;
-} DockGeometry;
+  int width, height;
+} WorkArea;
+
+// A window moody has seen created but not managed yet
+typedef struct {
+  Window window;
+  int x, y;
+  int width, height;
+  int override_redirect;
+  ClientActivity activity; // Handed on to the window once it's managed
+} PendingWindow;
+
+typedef struct {
+  int inner_gap, outer_gap;
+  int border_width;
+  char border_color[8];
+  char inactive_border_color[8];
+  unsigned long border_pixel, inactive_border_pixel;
+  unsigned int modifier;
+  bool park_hidden_windows;
+  int default_layout;
+  KeySym kill_key, next_window_key, prev_window_key, mru_window_key,
+      monocle_key;
+  KeySym focus_left_key, focus_right_key, focus_up_key, focus_down_key;
+  Keybinding *keybindings;
+  int num_keybindings;
+  StartupJob *jobs;
+  int num_jobs;
+  PoolCommand *pools;
+  int num_pools;
+  unsigned int freeze_workspaces; // Bit per workspace
+  int freeze_grace;               // ms
+  char **freeze_exempt;
+  int num_freeze_exempt;
+} Config;
+
+typedef struct {
+  unsigned long workspace_switches;
+  unsigned long long switch_ns; // Total time spent in switch_workspace
+  unsigned long windows_mapped, windows_unmapped;
+  unsigned long windows_parked, windows_unparked;
+  unsigned long own_unmaps_ignored, windows_withdrawn, windows_destroyed;
+  unsigned long tile_configures_sent, tile_configures_skipped;
+  unsigned long events_handled;
+  // Events are read and handled in batches, see handle_events
+  unsigned long event_batches, events_collapsed, max_batch;
+  unsigned long input_events;
+  long long input_wait_ns, max_input_wait_ns; // Batch read to handled
+  unsigned long colors_allocated, colors_freed;
+  unsigned long invariant_violations;
+  unsigned long configure_requests, synthetic_configure_notifies;
+  unsigned long configure_loops_broken, configure_requests_dropped;
+  struct timespec started;
+  long start_rss_kb;
+  long long session_ready_ns; // Until every startup job was ready, 0 before
+  unsigned long pool_hits, pool_misses;
+  // Keypress to MapNotify, from the pool and from a fresh process
+  unsigned long warm_launches, cold_launches;
+  long long warm_launch_ns, cold_launch_ns;
+  unsigned long processes_frozen, processes_thawed;
+  long long frozen_ns, cpu_saved_ns; // The CPU time is an estimate
+} Stats;
+
+// A startup job as the supervisor runs it
+typedef struct {
+  char *name, *command;
+  int ready_when; // READY_*
+  bool restart;
+  int deps[MAX_JOB_DEPS]; // Indices of the jobs it comes after
+  int num_deps;
+
+  pid_t pid;   // 0 when not running
+  pid_t group; // Process group of its last run, for READY_WINDOW
+  bool launched, ready, failed;
+  int crashes; // In a row, for the backoff
+  long long started_at;
+  long long restart_at; // 0 unless a restart is scheduled
+} Job;
+
+typedef struct {
+  Job jobs[MAX_JOBS];
+  int num_jobs;
+  int child_fd; // eventfd poked by SIGCHLD
+  long long started;
+} Supervisor;
+
+// What managing a window reads from the server
+typedef struct {
+  bool is_dock, is_floating;
+  int x, y, width, height;
+  SizeHints hints; // Not read for docks
+} WindowProperties;
+
+typedef struct {
+  pid_t pid;     // 0 for an empty slot, also its process group
+  Window window; // None until its window asked to be mapped
+  WindowProperties properties; // Read when it did
+  long long spawned_at;
+} PoolInstance;
+
+typedef struct {
+  char *command;
+  int size;
+  PoolInstance instances[MAX_POOL_SIZE];
+  int failures;       // Instances in a row that died without a window
+  long long refill_at; // Backoff after failures, 0 for right away
+} Pool;
+
+// What /proc/<pid>/stat says about a process
+typedef struct {
+  pid_t group;
+  long long cpu_ticks; // utime + stime
+  long rss_kb;
+} ProcessStat;
+
+// A client of moody's, over all its windows, past and present. Keyed by pid
+// and WM_CLIENT_MACHINE, pid 0 and no machine collects what can't be told
+// apart
+typedef struct {
+  pid_t pid; // _NET_WM_PID, 0 if unknown
+  char machine[64];
+  char command[32]; // Only for local clients
+  char wm_class[64];
+  ClientActivity activity;
+  // As of the last sample_clients, local clients only
+  long long cpu_ticks, sampled_at;
+  double cpu_share; // Of one CPU since the sample before, -1 on the first
+  long rss_kb;
+} ClientRecord;
+
+// A window that went away before the worker said whose it was. Its activity
+// is handed on when the answer comes
+typedef struct {
+  Window window;
+  ClientActivity activity;
+} DepartedWindow;
+
+typedef struct {
+  ClientRecord clients[MAX_CLIENTS];
+  int num_clients;
+  DepartedWindow departed[WORKER_QUEUE_SIZE];
+  int num_departed;
+  long long sampled_at;
+} ClientTable;
+
+// A row of the clients table: a client, or a window the worker hasn't
+// answered for yet
+typedef struct {
+  ClientRecord *client; // NULL for a window
+  Window window;
+  int windows;
+  ClientActivity activity;
+} ClientRow;
+
+// A process stopped because all its windows are hidden
+typedef struct {
+  int display;  // Whose windows they are
+  pid_t pid;    // _NET_WM_PID of the windows
+  pid_t target; // What got SIGSTOP, -pid for the whole process group
+  long long frozen_at;
+  double cpu_share; // Of one CPU, what it used while hidden before that
+} FrozenClient;
+
+// A binding's command on its way to the screen, for the launch latency
+typedef struct {
+  Window window; // None until a cold launch's window is matched
+  pid_t group;
+  long long pressed_at;
+  bool warm; // Came out of a pool
+} Launch;
+
+// Single producer, single consumer ring, no locks
+typedef struct {
+  ClientDetails items[WORKER_QUEUE_SIZE];
+  _Atomic unsigned int head, tail;
+} WorkQueue;
+
+typedef struct {
+  WorkQueue requests; // main -> worker, only the window is set
+  WorkQueue results;  // worker -> main
+  int requests_fd, results_fd; // eventfds to wake either side
+  Atom net_wm_pid, net_wm_name; // Interned on the worker's connection
+  Atom net_wm_strut, net_wm_strut_partial;
+  Display *dpy;                 // The worker's connection
+  pthread_t thread;
+  atomic_bool stopping; // Set by stop_worker
+} Worker;
@@ -0,0 +1,230 @@
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Synthetic sessions
+// Writes a trace of a busy made up session to stdout, for moody-replay to
+// train and benchmark on: map storms, focus cycling, drags and workspace
+// switches. The trace only has events, moody-replay makes up the replies.
+// Keys are sent the way moody-replay maps them (keycode = low byte of the
+// keysym) and with the default modifier from config.h
+
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+#define ROOT 0x1e0
+#define MOD Mod1Mask
+#define WINDOWS_PER_STORM 12
+#define MAX_SYNTH_WINDOWS 64
+
+static Window windows[MAX_SYNTH_WINDOWS];
+static int num_windows;
+static Window next_window = 0x400000;
+static unsigned long serial;
+
+static void write_event(XEvent *ev) {
+  ev->xany.serial = ++serial;
+  size_t size = trace_event_size(ev->type);
+  TraceRecord record = {.kind = TRACE_EVENT, .size = size};
+  fwrite(&record, sizeof(record), 1, stdout);
+  fwrite(ev, size, 1, stdout);
+}
+
+static void key(KeySym keysym, unsigned int state) {
+  XEvent ev = {0};
+  ev.xkey.type = KeyPress;
+  ev.xkey.window = ROOT;
+  ev.xkey.root = ROOT;
+  ev.xkey.keycode = keysym & 0xff;
+  ev.xkey.state = state;
+  write_event(&ev);
+
+  ev.type = KeyRelease;
+  write_event(&ev);
+}
+
+static void open_window() {
+  Window window = next_window++;
+  XEvent ev = {0};
+
+  ev.xcreatewindow.type = CreateNotify;
+  ev.xcreatewindow.parent = ROOT;
+  ev.xcreatewindow.window = window;
+  ev.xcreatewindow.x = rand() % SCREEN_WIDTH;
+  ev.xcreatewindow.y = rand() % SCREEN_HEIGHT;
+  ev.xcreatewindow.width = 200 + rand() % 600;
+  ev.xcreatewindow.height = 200 + rand() % 600;
+  write_event(&ev);
+
+  // Clients usually ask for a size before they map
+  memset(&ev, 0, sizeof(ev));
+  ev.xconfigurerequest.type = ConfigureRequest;
+  ev.xconfigurerequest.parent = ROOT;
+  ev.xconfigurerequest.window = window;
+  ev.xconfigurerequest.width = 640;
+  ev.xconfigurerequest.height = 480;
+  ev.xconfigurerequest.value_mask = CWWidth | CWHeight;
+  write_event(&ev);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.xmaprequest.type = MapRequest;
+  ev.xmaprequest.parent = ROOT;
+  ev.xmaprequest.window = window;
+  write_event(&ev);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.xproperty.type = PropertyNotify;
+  ev.xproperty.window = window;
+  ev.xproperty.atom = XA_WM_NAME;
+  write_event(&ev);
+
+  windows[num_windows++] = window;
+}
+
+static void close_window(int i) {
+  // The server reports the unmap to the root and to the window itself
+  XEvent ev = {0};
+  ev.xunmap.type = UnmapNotify;
+  ev.xunmap.event = ROOT;
+  ev.xunmap.window = windows[i];
+  write_event(&ev);
+  ev.xunmap.event = windows[i];
+  write_event(&ev);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.xdestroywindow.type = DestroyNotify;
+  ev.xdestroywindow.event = windows[i];
+  ev.xdestroywindow.window = windows[i];
+  write_event(&ev);
+
+  windows[i] = windows[--num_windows];
+}
+
+static void enter(Window window) {
+  XEvent ev = {0};
+  ev.xcrossing.type = EnterNotify;
+  ev.xcrossing.window = window;
+  ev.xcrossing.root = ROOT;
+  write_event(&ev);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.xfocus.type = FocusIn;
+  ev.xfocus.window = window;
+  write_event(&ev);
+}
+
+static void drag(Window window, unsigned int button) {
+  XEvent ev = {0};
+  int x = rand() % SCREEN_WIDTH, y = rand() % SCREEN_HEIGHT;
+
+  ev.xbutton.type = ButtonPress;
+  ev.xbutton.window = ROOT;
+  ev.xbutton.root = ROOT;
+  ev.xbutton.subwindow = window;
+  ev.xbutton.x_root = x;
+  ev.xbutton.y_root = y;
+  ev.xbutton.button = button;
+  ev.xbutton.state = MOD;
+  write_event(&ev);
+
+  for (int i = 0; i < 100; i++) {
+    memset(&ev, 0, sizeof(ev));
+    ev.xmotion.type = MotionNotify;
+    ev.xmotion.window = ROOT;
+    ev.xmotion.root = ROOT;
+    ev.xmotion.x_root = x += rand() % 7 - 3;
+    ev.xmotion.y_root = y += rand() % 7 - 3;
+    ev.xmotion.state = MOD | (button == Button1 ? Button1Mask : Button3Mask);
+    write_event(&ev);
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.xbutton.type = ButtonRelease;
+  ev.xbutton.window = ROOT;
+  ev.xbutton.root = ROOT;
+  ev.xbutton.button = button;
+  write_event(&ev);
+}
+
+static void round_of_work() {
+  // Map storm
+  for (int i = 0; i < WINDOWS_PER_STORM; i++) {
+    open_window();
+  }
+
+  // Focus cycling, by mouse and keys
+  for (int i = 0; i < num_windows; i++) {
+    enter(windows[rand() % num_windows]);
+  }
+  for (int i = 0; i < 20; i++) {
+    key(rand() % 2 ? XK_k : XK_j, MOD);
+  }
+  for (int i = 0; i < 20; i++) {
+    key(XK_Left + rand() % 4, MOD);
+  }
+
+  // The same in monocle, where every step swaps the one tile shown
+  key(XK_m, MOD);
+  for (int i = 0; i < 20; i++) {
+    key(rand() % 2 ? XK_k : XK_j, MOD);
+  }
+  key(XK_m, MOD);
+
+  drag(windows[rand() % num_windows], Button1);
+  drag(windows[rand() % num_windows], Button3);
+
+  // Spread the focused window around and flip through the workspaces
+  for (int i = 0; i < 4; i++) {
+    key(XK_2 + i, MOD | ShiftMask);
+    key(XK_k, MOD);
+  }
+  for (int i = 0; i < 3 * 9; i++) {
+    key(XK_1 + i % 9, MOD);
+  }
+  key(XK_1, MOD);
+
+  // Close them all, including the ones moved away
+  while (num_windows > 0) {
+    close_window(rand() % num_windows);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = 50;
+  unsigned int seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+    switch (opt) {
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      errx(1, "usage: %s [-r rounds] [-s seed] > trace", argv[0]);
+    }
+  }
+  srand(seed);
+
+  TraceHeader header = {
+      .magic = TRACE_MAGIC,
+      .screen_width = SCREEN_WIDTH,
+      .screen_height = SCREEN_HEIGHT,
+      .root = ROOT,
+      .flags = TRACE_SYNTHETIC,
+  };
+  fwrite(&header, sizeof(header), 1, stdout);
+
+  for (int i = 0; i < rounds; i++) {
+    round_of_work();
+  }
+  return 0;
+}
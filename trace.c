@@ -0,0 +1,230 @@
+#include <X11/XKBlib.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Recording
+// The Makefile links moody with --wrap for every call below, so moody's calls
+// land in __wrap_X* first. Only the main connection is recorded, the worker
+// thread's connection is passed straight through
+
+static FILE *trace_file;
+static Display *traced_dpy;
+
+int __real_XNextEvent(Display *dpy, XEvent *ev);
+Atom __real_XInternAtom(Display *dpy, const char *name, Bool only_if_exists);
+int __real_XGetWindowProperty(Display *dpy, Window win, Atom property,
+                              long offset, long length, Bool delete,
+                              Atom req_type, Atom *actual_type,
+                              int *actual_format, unsigned long *nitems,
+                              unsigned long *bytes_after,
+                              unsigned char **prop);
+Status __real_XGetTransientForHint(Display *dpy, Window win,
+                                   Window *transient_for);
+Status __real_XGetWMNormalHints(Display *dpy, Window win, XSizeHints *hints,
+                                long *supplied);
+Status __real_XGetWindowAttributes(Display *dpy, Window win,
+                                   XWindowAttributes *attr);
+Status __real_XAllocColor(Display *dpy, Colormap cmap, XColor *color);
+KeyCode __real_XKeysymToKeycode(Display *dpy, KeySym keysym);
+#if NeedWidePrototypes
+KeySym __real_XkbKeycodeToKeysym(Display *dpy, unsigned int keycode, int group,
+                                 int level);
+#else
+KeySym __real_XkbKeycodeToKeysym(Display *dpy, KeyCode keycode, int group,
+                                 int level);
+#endif
+
+static void write_record(uint8_t kind, const void *payload, size_t size,
+                         const void *extra, size_t extra_size) {
+  TraceRecord record = {.kind = kind, .size = size + extra_size};
+  fwrite(&record, sizeof(record), 1, trace_file);
+  fwrite(payload, size, 1, trace_file);
+  if (extra_size) {
+    fwrite(extra, extra_size, 1, trace_file);
+  }
+}
+
+// Reply records are the call id followed by the reply data
+static void write_reply(uint8_t call, const void *data, size_t size,
+                        const void *extra, size_t extra_size) {
+  unsigned char buf[1 + sizeof(XWindowAttributes) + 64];
+  buf[0] = call;
+  memcpy(buf + 1, data, size);
+  write_record(TRACE_REPLY, buf, size + 1, extra, extra_size);
+}
+
+static int recording(Display *dpy) { return trace_file && dpy == traced_dpy; }
+
+void trace_open(const char *path, Display *dpy) {
+  trace_file = fopen(path, "wb");
+  if (!trace_file) {
+    perror(path);
+    exit(1);
+  }
+  traced_dpy = dpy;
+
+  TraceHeader header = {
+      .magic = TRACE_MAGIC,
+      .screen_width = DisplayWidth(dpy, DefaultScreen(dpy)),
+      .screen_height = DisplayHeight(dpy, DefaultScreen(dpy)),
+      .root = RootWindow(dpy, DefaultScreen(dpy)),
+  };
+  fwrite(&header, sizeof(header), 1, trace_file);
+  printf("Recording session to %s\n", path);
+}
+
+// Called whenever moody is about to block, so an interrupted session loses
+// at most the current burst
+void trace_flush() {
+  if (trace_file) {
+    fflush(trace_file);
+  }
+}
+
+void trace_client_details(Display *dpy, const struct ClientDetails *details,
+                          size_t size) {
+  if (recording(dpy)) {
+    write_record(TRACE_DETAILS, details, size, NULL, 0);
+  }
+}
+
+void trace_event_start(int type) {}
+
+void trace_batch_end(Display *dpy) {
+  if (recording(dpy)) {
+    write_record(TRACE_BATCH, NULL, 0, NULL, 0);
+  }
+}
+
+int __wrap_XNextEvent(Display *dpy, XEvent *ev) {
+  int result = __real_XNextEvent(dpy, ev);
+  if (recording(dpy)) {
+    write_record(TRACE_EVENT, ev, trace_event_size(ev->type), NULL, 0);
+  }
+  return result;
+}
+
+Atom __wrap_XInternAtom(Display *dpy, const char *name, Bool only_if_exists) {
+  Atom atom = __real_XInternAtom(dpy, name, only_if_exists);
+  if (recording(dpy)) {
+    uint64_t value = atom;
+    write_reply(TRACE_INTERN_ATOM, &value, sizeof(value), NULL, 0);
+  }
+  return atom;
+}
+
+int __wrap_XGetWindowProperty(Display *dpy, Window win, Atom property,
+                              long offset, long length, Bool delete,
+                              Atom req_type, Atom *actual_type,
+                              int *actual_format, unsigned long *nitems,
+                              unsigned long *bytes_after,
+                              unsigned char **prop) {
+  int status = __real_XGetWindowProperty(
+      dpy, win, property, offset, length, delete, req_type, actual_type,
+      actual_format, nitems, bytes_after, prop);
+  if (recording(dpy)) {
+    TracePropertyReply reply = {.status = status};
+    size_t data_size = 0;
+    if (status == Success) {
+      reply.actual_type = *actual_type;
+      reply.actual_format = *actual_format;
+      reply.nitems = *nitems;
+      reply.bytes_after = *bytes_after;
+      // Xlib hands out 32 bit properties as longs
+      if (*prop) {
+        data_size = *nitems * (*actual_format == 32   ? sizeof(long)
+                               : *actual_format == 16 ? sizeof(short)
+                                                      : 1);
+      }
+    }
+    write_reply(TRACE_GET_WINDOW_PROPERTY, &reply, sizeof(reply),
+                data_size ? *prop : NULL, data_size);
+  }
+  return status;
+}
+
+Status __wrap_XGetTransientForHint(Display *dpy, Window win,
+                                   Window *transient_for) {
+  Status status = __real_XGetTransientForHint(dpy, win, transient_for);
+  if (recording(dpy)) {
+    uint64_t reply[2] = {status, status ? *transient_for : None};
+    write_reply(TRACE_GET_TRANSIENT_FOR_HINT, reply, sizeof(reply), NULL, 0);
+  }
+  return status;
+}
+
+Status __wrap_XGetWMNormalHints(Display *dpy, Window win, XSizeHints *hints,
+                                long *supplied) {
+  Status status = __real_XGetWMNormalHints(dpy, win, hints, supplied);
+  if (recording(dpy)) {
+    struct {
+      int32_t status;
+      XSizeHints hints;
+      long supplied;
+    } reply = {.status = status};
+    if (status) {
+      reply.hints = *hints;
+      reply.supplied = *supplied;
+    }
+    write_reply(TRACE_GET_WM_NORMAL_HINTS, &reply, sizeof(reply), NULL, 0);
+  }
+  return status;
+}
+
+Status __wrap_XGetWindowAttributes(Display *dpy, Window win,
+                                   XWindowAttributes *attr) {
+  Status status = __real_XGetWindowAttributes(dpy, win, attr);
+  if (recording(dpy)) {
+    struct {
+      int32_t status;
+      XWindowAttributes attr;
+    } reply = {.status = status};
+    if (status) {
+      reply.attr = *attr;
+      reply.attr.visual = NULL;
+      reply.attr.screen = NULL;
+    }
+    write_reply(TRACE_GET_WINDOW_ATTRIBUTES, &reply, sizeof(reply), NULL, 0);
+  }
+  return status;
+}
+
+Status __wrap_XAllocColor(Display *dpy, Colormap cmap, XColor *color) {
+  Status status = __real_XAllocColor(dpy, cmap, color);
+  if (recording(dpy)) {
+    struct {
+      int32_t status;
+      XColor color;
+    } reply = {.status = status, .color = *color};
+    write_reply(TRACE_ALLOC_COLOR, &reply, sizeof(reply), NULL, 0);
+  }
+  return status;
+}
+
+KeyCode __wrap_XKeysymToKeycode(Display *dpy, KeySym keysym) {
+  KeyCode keycode = __real_XKeysymToKeycode(dpy, keysym);
+  if (recording(dpy)) {
+    write_reply(TRACE_KEYSYM_TO_KEYCODE, &keycode, sizeof(keycode), NULL, 0);
+  }
+  return keycode;
+}
+
+KeySym __wrap_XkbKeycodeToKeysym(Display *dpy,
+#if NeedWidePrototypes
+                                 unsigned int keycode,
+#else
+                                 KeyCode keycode,
+#endif
+                                 int group, int level) {
+  KeySym keysym = __real_XkbKeycodeToKeysym(dpy, keycode, group, level);
+  if (recording(dpy)) {
+    uint64_t value = keysym;
+    write_reply(TRACE_KEYCODE_TO_KEYSYM, &value, sizeof(value), NULL, 0);
+  }
+  return keysym;
+}
@@ -0,0 +1,114 @@
+#include <X11/Xlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Session traces
+// moody -t <file> records every event it reads, the replies to every request
+// it waits on and the worker's results into <file>. moody-replay -t <file>
+// feeds the same trace back through moody's event handling with no X server
+// (see replay.c)
+
+#define TRACE_MAGIC "MOODYTR3"
+
+// Header flags
+#define TRACE_SYNTHETIC 1 // Written by moody-synth, has no replies
+
+// Record kinds
+#define TRACE_EVENT 1   // A compacted XEvent
+#define TRACE_REPLY 2   // Reply data, first byte says which call
+#define TRACE_DETAILS 3 // A ClientDetails from the worker
+#define TRACE_BATCH 4   // End of a batch of events, no payload
+
+// Calls with replies, in TRACE_REPLY records
+#define TRACE_INTERN_ATOM 1
+#define TRACE_GET_WINDOW_PROPERTY 2
+#define TRACE_GET_TRANSIENT_FOR_HINT 3
+#define TRACE_GET_WM_NORMAL_HINTS 4
+#define TRACE_GET_WINDOW_ATTRIBUTES 5
+#define TRACE_ALLOC_COLOR 6
+#define TRACE_KEYSYM_TO_KEYCODE 7
+#define TRACE_KEYCODE_TO_KEYSYM 8
+
+typedef struct {
+  char magic[8];
+  int32_t screen_width, screen_height;
+  uint64_t root;
+  uint32_t flags;
+} TraceHeader;
+
+// Every record starts with this, followed by size bytes of payload
+typedef struct {
+  uint8_t kind;
+  uint32_t size;
+} __attribute__((packed)) TraceRecord;
+
+// Fixed part of a TRACE_GET_WINDOW_PROPERTY reply, the property data follows
+typedef struct {
+  int32_t status;
+  uint64_t actual_type;
+  int32_t actual_format;
+  uint64_t nitems, bytes_after;
+} __attribute__((packed)) TracePropertyReply;
+
+// Bytes of an XEvent worth keeping for its type
+static inline size_t trace_event_size(int type) {
+  switch (type) {
+  case KeyPress:
+  case KeyRelease:
+    return sizeof(XKeyEvent);
+  case ButtonPress:
+  case ButtonRelease:
+    return sizeof(XButtonEvent);
+  case MotionNotify:
+    return sizeof(XMotionEvent);
+  case EnterNotify:
+  case LeaveNotify:
+    return sizeof(XCrossingEvent);
+  case FocusIn:
+  case FocusOut:
+    return sizeof(XFocusChangeEvent);
+  case Expose:
+    return sizeof(XExposeEvent);
+  case CreateNotify:
+    return sizeof(XCreateWindowEvent);
+  case DestroyNotify:
+    return sizeof(XDestroyWindowEvent);
+  case UnmapNotify:
+    return sizeof(XUnmapEvent);
+  case MapNotify:
+    return sizeof(XMapEvent);
+  case MapRequest:
+    return sizeof(XMapRequestEvent);
+  case ConfigureNotify:
+    return sizeof(XConfigureEvent);
+  case ConfigureRequest:
+    return sizeof(XConfigureRequestEvent);
+  case PropertyNotify:
+    return sizeof(XPropertyEvent);
+  case ClientMessage:
+    return sizeof(XClientMessageEvent);
+  default:
+    return sizeof(XEvent);
+  }
+}
+
+struct ClientDetails;
+
+// Implemented by trace.c for moody and by replay.c for moody-replay
+void trace_open(const char *path, Display *dpy);
+void trace_flush();
+// Only the traced display's, like every recorded call
+void trace_client_details(Display *dpy, const struct ClientDetails *details,
+                          size_t size);
+// Around the handlers of an event batch, so a replay reads the same batches
+// and can time each event on its own
+void trace_event_start(int type);
+void trace_batch_end(Display *dpy);
+
+// moody.c, hands a worker result to the client it belongs to
+void apply_client_details(Display *dpy, struct ClientDetails *details);
+
+#endif